@@ -0,0 +1,70 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _COMMAND_FILTER_H
+#define _COMMAND_FILTER_H
+
+// Decides which velocity axes actually need a new command sent to the
+// robot.  Targets are in the firmware's units (mm/s, deg/s) and are rounded
+// to whole units.  An axis is only re-sent when its target has moved more
+// than half a unit plus the hysteresis away from what was last sent, so a
+// target hovering at a rounding boundary doesn't flap, and no more often
+// than the minimum interval.  Going to zero is always sent straight away.
+class CommandFilter
+{
+  public:
+    enum Axis { AXIS_X, AXIS_Y, AXIS_YAW, AXIS_COUNT };
+
+    CommandFilter();
+
+    // hysteresis in units beyond the half unit of rounding; min_interval in s
+    void Init( double hysteresis, double min_interval );
+
+    // bitmask of the axes the robot can be commanded on (x and yaw to start)
+    void SetAxes( unsigned int axes ) { axes_ = axes; Reset(); }
+
+    // forget what was sent, so the next targets all go out
+    void Reset();
+
+    // targets[] for each axis; fills values[] with what to send and returns
+    // a bitmask of (1 << axis) for the axes that should be sent now
+    unsigned int Update( double now, const double targets[AXIS_COUNT],
+                         int values[AXIS_COUNT] );
+
+    // whether an axis was held back by the minimum interval
+    bool Pending() const { return pending_; }
+
+    unsigned int sent;
+    unsigned int suppressed;
+
+  private:
+    double hysteresis_;
+    double min_interval_;
+    unsigned int axes_;
+    bool   pending_;
+    bool   valid_[AXIS_COUNT];
+    int    last_[AXIS_COUNT];
+    double last_time_[AXIS_COUNT];
+};
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _CONTROL_LOOP_H
+#define _CONTROL_LOOP_H
+
+#include <ros/ros.h>
+#include <controller_manager/controller_manager.h>
+
+#include <p2os.h>
+
+// The driver's control loop, one cycle at a time, and the threads it runs
+// on in real-time mode
+
+void send_commands( P2OSNode *p, controller_manager::ControllerManager &cm, ros::Duration period );
+
+// at a fixed rate; reads one SIP, or everything queued with drain_sips
+void control_cycle( P2OSNode *p, controller_manager::ControllerManager &cm, ros::Rate &rate );
+
+// paced by the robot's SIPs; last is when the previous cycle ran
+void sip_locked_cycle( P2OSNode *p, controller_manager::ControllerManager &cm, ros::Time &last );
+
+// runs the loop at SCHED_FIFO priority, pinned to cpu unless it is -1, and
+// shuts the node down when it ends
+void control_thread( P2OSNode *p, controller_manager::ControllerManager *cm,
+                     int priority, int cpu );
+
+// publishes what the real-time loop fills in (see SetDeferPublish())
+void publish_thread( P2OSNode *p );
+
+#endif
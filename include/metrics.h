@@ -0,0 +1,129 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <ostream>
+#include <string>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+// Latency buckets are powers of two from 1 us up, plus an overflow bucket
+#define METRICS_BUCKETS 22
+
+// Histogram of how long something took.  It is written from one thread and
+// read from another, so each field is a relaxed atomic: recording costs a
+// few uncontended increments and the reader may see a sample half added.
+class LatencyHistogram
+{
+  public:
+    LatencyHistogram();
+
+    void Record( uint64_t ns );
+    void Write( std::ostream &out, const char *name, const char *stage ) const;
+
+  private:
+    boost::atomic<uint64_t> buckets_[METRICS_BUCKETS];
+    boost::atomic<uint64_t> count_;
+    boost::atomic<uint64_t> sum_ns_;
+};
+
+// Timings of each stage of the SIP loop and a few counters, served as
+// Prometheus text format over HTTP on a localhost port.  Nothing is
+// recorded unless the endpoint has been started.
+class Metrics
+{
+  public:
+    enum Stage
+    {
+        STAGE_READ,     // waiting for the first byte of a packet
+        STAGE_FRAME,    // from the header to a packet with a good checksum
+        STAGE_PARSE,    // SIP::ParseStandard()
+        STAGE_FILL,     // choosing outputs and filling the messages
+        STAGE_PUBLISH,  // StandardSIPPutData()
+        STAGE_CYCLE,    // from the start of one control cycle to the next
+        STAGE_COUNT
+    };
+
+    enum Counter
+    {
+        PACKETS,
+        SIPS,
+        COMMANDS_SENT,
+        CHECKSUM_FAILURES,
+        BYTES_SKIPPED,
+        UNEXPECTED_PACKETS,
+        COALESCED_SIPS,
+        COUNTER_COUNT
+    };
+
+    Metrics();
+    ~Metrics();
+
+    // monotonic time in ns, for passing to Record()
+    static uint64_t Now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    bool Enabled() const { return enabled_; }
+
+    void Record( Stage stage, uint64_t start, uint64_t end )
+    {
+        if( enabled_ && end > start )
+            stages_[stage].Record(end - start);
+    }
+
+    void Add( Counter counter, uint64_t n = 1 )
+    {
+        if( enabled_ )
+            counters_[counter].fetch_add(n, boost::memory_order_relaxed);
+    }
+
+    void Write( std::ostream &out ) const;
+
+    // serve on 127.0.0.1:port from a thread of its own; returns 0 on success
+    int Start( int port );
+    void Stop();
+
+  private:
+    void Serve();
+
+    bool enabled_;
+    int listen_fd_;
+    // the connection being answered (-1 if none), so Stop() can cut it off
+    boost::mutex client_mutex_;
+    int client_fd_;
+    bool stopping_;
+    boost::thread thread_;
+    LatencyHistogram stages_[STAGE_COUNT];
+    boost::atomic<uint64_t> counters_[COUNTER_COUNT];
+};
+
+#endif
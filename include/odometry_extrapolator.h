@@ -0,0 +1,76 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ODOMETRY_EXTRAPOLATOR_H
+#define _ODOMETRY_EXTRAPOLATOR_H
+
+#include <boost/thread.hpp>
+
+#include "ros/ros.h"
+#include "nav_msgs/Odometry.h"
+
+// Publishes odometry faster than SIPs arrive by carrying the last SIP pose
+// forward in time on its own thread.  The velocity is assumed to move from
+// the measured twist towards the commanded one with a first-order lag, and
+// is integrated for no more than a maximum horizon past the SIP; the output
+// is stamped with the time it was carried to.  Output goes on its own topic
+// so that it is never mistaken for measured odometry.
+class OdometryExtrapolator
+{
+  public:
+    OdometryExtrapolator();
+    ~OdometryExtrapolator();
+
+    // rate in Hz (0 = off); time_constant (s) of the lag towards the
+    // commanded velocity (0 = keep the measured one); horizon in s
+    void Start( ros::NodeHandle &n, const std::string &topic,
+                const std::string &frame_id, const std::string &child_frame_id,
+                double rate, double time_constant, double horizon );
+    void Stop();
+
+    // called with each new SIP's time and odometry, and the velocity the
+    // robot is being commanded to
+    void Update( const ros::Time &ts, const nav_msgs::Odometry &odom,
+                 double cmd_vx, double cmd_va );
+
+  private:
+    void Run();
+
+    ros::Publisher pub_;
+    boost::thread thread_;
+    boost::mutex mutex_;
+    double rate_, time_constant_, horizon_;
+
+    // The publishing thread's message; its frame ids are set once
+    nav_msgs::Odometry odom_;
+
+    // guarded by mutex_; only the numbers are copied per SIP, so that
+    // Update() never allocates
+    ros::Time stamp_;
+    geometry_msgs::PoseWithCovariance pose_;
+    geometry_msgs::TwistWithCovariance twist_;
+    double cmd_[2];
+    bool have_odom_;
+};
+
+#endif
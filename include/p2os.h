@@ -25,19 +25,29 @@
 #define _P2OSDEVICE_H
 
 #include <pthread.h>
+#include <boost/thread/condition_variable.hpp>
 #include <sys/time.h>
 #include <iostream>
 #include <string.h>
 
 #include "packet.h"
 #include "robot_params.h"
+#include "publish_policy.h"
+#include "velocity_estimator.h"
+#include "odometry_extrapolator.h"
+#include "metrics.h"
+#include "command_filter.h"
+#include "velocity_smoother.h"
+#include "pi_mutex.h"
 
 #include "ros/ros.h"
 #include "nav_msgs/Odometry.h"
 #include "geometry_msgs/Twist.h"
 #include <std_srvs/Empty.h>
 #include <sensor_msgs/Range.h>
+#include <sensor_msgs/PointCloud2.h>
 #include <tf/transform_broadcaster.h>
+#include <tf/transform_listener.h>
 #include <p2os_driver/BatteryState.h>
 #include <p2os_driver/MotorState.h>
 #include <p2os_driver/GripperState.h>
@@ -70,6 +80,41 @@ typedef struct ros_p2os_data
   geometry_msgs::TransformStamped odom_trans;
 } ros_p2os_data_t;
 
+// What goes out of a SIP besides the fields FillStandard() brings up to date
+// (SIPFillFields), see TakeOutputs()
+enum SIPPutOutputs {
+  PUT_POSE = 0x100,
+  PUT_TF   = 0x200,
+  PUT_PTZ  = 0x400
+};
+
+// Most packets ReceiveSIP() reads in one go; the rest wait for the next cycle
+#define RX_QUEUE_LEN 16
+
+// Counters kept by SendReceive() for the link diagnostics
+#define LINK_INTERVAL_BINS 9
+typedef struct link_stats
+{
+  unsigned int sips;
+  unsigned int checksum_failures;
+  unsigned int bytes_skipped;
+  unsigned int resyncs;
+  unsigned int unexpected;
+  // time between consecutive SIPs
+  unsigned int intervals;
+  double interval_sum;
+  double interval_sum_sq;
+  unsigned int interval_hist[LINK_INTERVAL_BINS];
+  // ReceiveSIP(): time from a SIP being readable to it being published,
+  // cycles that found a SIP already queued, and older SIPs parsed but not
+  // published
+  unsigned int latencies;
+  double latency_sum;
+  double latency_max;
+  unsigned int late_cycles;
+  unsigned int coalesced;
+} link_stats_t;
+
 // this is here because we need the above typedef's before including it.
 #include "sip.h"
 #include "kinecalc.h"
@@ -99,13 +144,38 @@ class P2OSNode : public hardware_interface::RobotHW
     int Shutdown();
 
     int SendReceive(P2OSPacket* pkt, bool publish_data = true );
+    int WaitForData(double timeout, uint64_t &ready);
+    int ReceiveSIP(uint64_t ready, bool late);
+    // waits up to timeout seconds for more of the camera's reply; lock holds
+    // the state lock, once
+    void ReceiveAux(PiMutex::scoped_lock &lock, double timeout);
+    // commands are only written; the caller reads with ReceiveSIP()
+    void SetSendOnly(bool send_only) { send_only_ = send_only; }
+    void SetDrainSips(bool drain_sips) { drain_sips_ = drain_sips; }
+    // SIPs are only filled in by the control loop; another thread publishes
+    // them with PublishPending()
+    void SetDeferPublish(bool defer) { defer_publish_ = defer; }
+    void PublishPending(double timeout);
 
     void updateDiagnostics();
 
     void ResetRawPositions();
     void ToggleSonarPower(unsigned char val);
     void ToggleMotorPower(unsigned char val);
-    void StandardSIPPutData(ros::Time ts);
+    unsigned int BatteryValue();
+    unsigned int MotorValue();
+    unsigned int GripperValue();
+    unsigned int OutputsDue(ros::Time ts);
+    void StandardSIPPutData(ros::Time ts, unsigned int fields);
+    unsigned int TakeOutputs(ros::Time ts, unsigned int fields, uint32_t &sonars);
+    void PutOutputs(ros_p2os_data_t &data, const p2os_driver::PTZState &ptz,
+                    uint32_t sonars, ros::Time ts, unsigned int outputs);
+    void ConfigureForRobot();
+    void SendConfiguration();
+    void CheckConfiguration();
+    void SetupSonar();
+    std::string SonarFrameId(int index);
+    void UpdateSonarCloud(const p2os_driver::SonarArray &sonar, uint32_t updated);
 
     inline double TicksToDegrees (int joint, unsigned char ticks);
     inline unsigned char DegreesToTicks (int joint, double degrees);
@@ -115,8 +185,14 @@ class P2OSNode : public hardware_interface::RobotHW
     inline double SecsPerTicktoRadsPerSec (int joint, double secs);
 
     void SendPulse (void);
+    void check_and_send_pulse();
     //void spin();
     void check_and_set_vel();
+    void check_cmdvel_timeout();
+    double TimeToCmdVelTimeout();
+    double LimitSpeed( double demand, int max, const char *axis );
+    void SendVelocity( unsigned char command, int value );
+    void SendWheelVelocities( int vx, int va );
     void cmdvel_cb( const geometry_msgs::TwistConstPtr &);
 
     void check_and_set_motor_state();
@@ -126,16 +202,31 @@ class P2OSNode : public hardware_interface::RobotHW
     void gripperCallback(const p2os_driver::GripperStateConstPtr &msg);
 
     void sonar_cb(const p2os_driver::SonarStateConstPtr &msg);
+    void ptz_cb(const p2os_driver::PTZStateConstPtr &msg);
+
+    // Held while the control loop sends commands and uses what it read, and
+    // by every callback, so the robot state is only used by one thread at a
+    // time.  The control loop reads the link without it (see ReceiveSIP()).
+    PiMutex &get_state_mutex() { return state_mutex_; }
+    // marks the start of a control cycle, for the cycle timing metrics
+    void CycleStarted();
     
-    void check_and_set_arm_state(ros::Time time, ros::Duration period, controller_manager::ControllerManager &cm);
+    // reads the arm and base joints, updates the controllers and writes
+    // their commands back
+    void check_and_set_controllers(ros::Time time, ros::Duration period, controller_manager::ControllerManager &cm);
 
     double get_pulse() {return pulse;}
     bool get_psos_use_tcp() {return psos_use_tcp;}
     double get_frequency() {return frequency;}
+    bool get_sip_locked() {return sip_locked_;}
+    bool get_drain_sips() {return drain_sips_;}
 
     // diagnostic messages
     void check_voltage( diagnostic_updater::DiagnosticStatusWrapper &stat );
     void check_stall( diagnostic_updater::DiagnosticStatusWrapper &stat );
+    void check_odometry( diagnostic_updater::DiagnosticStatusWrapper &stat );
+    void check_link( diagnostic_updater::DiagnosticStatusWrapper &stat );
+    void check_cmdvel_watchdog( diagnostic_updater::DiagnosticStatusWrapper &stat );
 
 
 
@@ -148,10 +239,36 @@ class P2OSNode : public hardware_interface::RobotHW
     ros::NodeHandle n;
     ros::NodeHandle nh_private;
     void write_arm_state(ros::Time time, ros::Duration period);
+    void base_initialize();
+    void read_base_state();
+    void write_base_state();
+    void ReadPacket(P2OSPacket &packet);
+    void CountPacket(const P2OSPacket &packet);
+    void ParseSIP(P2OSPacket &packet);
+    void UseSIP(ros::Time ts, bool publish_data);
+    void HandlePacket(P2OSPacket &packet, bool publish_data);
     bool psos_use_tcp;
     bool use_arm_;
     bool arm_initialized_;
+    bool use_base_controller_;
     double frequency;
+    bool sip_locked_;
+    bool drain_sips_;
+    bool send_only_;
+    // packets ReceiveSIP() has read but not yet used
+    P2OSPacket rx_queue_[RX_QUEUE_LEN];
+    // what the control loop left for PublishPending()
+    bool defer_publish_;
+    bool publish_pending_;
+    ros::Time publish_ts_;
+    unsigned int publish_fields_;
+    boost::condition_variable_any publish_cond_;
+    // PublishPending()'s copy of what it publishes, so roscpp works on it
+    // without the state lock
+    ros_p2os_data_t publish_data_;
+    p2os_driver::PTZState publish_ptz_;
+    // signalled when the control loop hands the PTZ more of a reply
+    boost::condition_variable_any aux_cond_;
 
     diagnostic_updater::Updater diagnostic_;
     diagnostic_updater::DiagnosedPublisher<p2os_driver::BatteryState> batt_pub_;
@@ -161,9 +278,20 @@ class P2OSNode : public hardware_interface::RobotHW
                 grip_state_pub_,
                 ptz_state_pub_, 
                 sonar_pub_, 
+                sonar_array_pub_,
+                sonar_cloud_pub_,
                 aio_pub_, 
                 dio_pub_;
                 
+    PublishPolicy   tf_policy_,
+                pose_policy_,
+                batt_policy_,
+                mstate_policy_,
+                grip_state_policy_,
+                ptz_state_policy_,
+                aio_policy_,
+                dio_policy_;
+
     ros::Subscriber cmdvel_sub_, 
                 cmdmstate_sub_, 
                 gripper_sub_, 
@@ -171,8 +299,25 @@ class P2OSNode : public hardware_interface::RobotHW
                 ptz_cmd_sub_;
 
     tf::TransformBroadcaster odom_broadcaster;
+    bool publish_tf_;
+    VelocityEstimator velocity_estimator_;
+    // SIP::sipCount at the last velocity estimate
+    unsigned int estimator_sips_;
+    OdometryExtrapolator extrapolator_;
     ros::Time veltime;
 
+    // cmd_vel watchdog; times are monotonic ns, see Metrics::Now()
+    double      cmdvel_timeout_;
+    bool        cmdvel_timeout_estop_;
+    uint64_t    cmdvel_last_;
+    bool        cmdvel_timed_out_;
+    unsigned int cmdvel_timeouts_;
+    bool cmdvel_moving() const;
+    CommandFilter cmd_filter_;
+    bool        smooth_cmd_vel_;
+    VelocitySmoother smoother_;
+    double      smoother_last_;
+
     hardware_interface::JointStateInterface jnt_state_interface;
     hardware_interface::PositionJointInterface jnt_pos_interface;
     std::vector<double> arm_cmd;
@@ -180,6 +325,16 @@ class P2OSNode : public hardware_interface::RobotHW
     std::vector<double> arm_vel;
     std::vector<double> arm_eff;
 
+    // left and right wheels, for ros_control base controllers
+    hardware_interface::VelocityJointInterface jnt_vel_interface_;
+    double wheel_radius_;
+    double wheel_cmd_[2];
+    double wheel_cmd_last_[2];
+    double wheel_pos_[2];
+    double wheel_vel_[2];
+    double wheel_eff_[2];
+    ros::Time wheel_stamp_;
+
     SIP* sippacket;
     std::string psos_serial_port;
     std::string psos_tcp_host;
@@ -187,6 +342,15 @@ class P2OSNode : public hardware_interface::RobotHW
     int         psos_tcp_port;
     bool        vel_dirty, motor_dirty;
     bool        gripper_dirty_;
+
+    Metrics     metrics_;
+    uint64_t    cycle_start_;
+    PiMutex     state_mutex_;
+    double      sip_debug_period_;
+    int         odom_max_late_cycles_;
+    link_stats_t link_, link_reported_;
+    ros::Time   link_last_sip_, link_reported_time_;
+    unsigned int last_odom_rejected_;
     int         param_idx;
     // PID settings
     int rot_kp, rot_kv, rot_ki, trans_kp, trans_kv, trans_ki;
@@ -194,16 +358,31 @@ class P2OSNode : public hardware_interface::RobotHW
     int bumpstall;
     int joystick;
     int direct_wheel_vel_control;
+    // last VEL2 wheel speeds sent, in Vel2Divisor units
+    bool vel2_sent_;
+    unsigned char vel2_last_[2];
     int radio_modemp;
     int NumberOfJoints;
     int motor_max_speed;
+    int motor_max_latspeed;
     int motor_max_turnspeed;
     short motor_max_trans_accel, motor_max_trans_decel;
     short motor_max_rot_accel, motor_max_rot_decel;
     double pulse; // Pulse time
+    double pulse_period; // Seconds without a command before a pulse is sent
     double desired_freq;
-    double lastPulseTime; // Last time of sending a pulse or command to the robot
+    double lastPulseTime; // Last time of sending a pulse or command to the robot (monotonic s)
     bool use_sonar_;
+    bool publish_sonar_range_;
+    sensor_msgs::Range sonar_range_;
+    std::string tf_prefix_;
+    std::string odom_frame_id_;
+    std::string base_frame_id_;
+    std::string sonar_frame_prefix_;
+    std::vector<std::string> sonar_frame_ids_;
+    double sonar_max_range_;
+    sensor_msgs::PointCloud2 sonar_cloud_;
+    std::vector<double> sonar_x_, sonar_y_, sonar_cos_, sonar_sin_;
     
     P2OSPtz ptz_;
 };
@@ -159,7 +159,7 @@ class P2OSPtz
 
   // Simple getters and setters
   bool isOn() const { return is_on_; }
-  p2os_driver::PTZState getCurrentState() { return current_state_; }
+  const p2os_driver::PTZState &getCurrentState() const { return current_state_; }
 
   // Class members
  protected:
@@ -179,6 +179,7 @@ class P2OSPtz
   static const int MAX_REQUEST_LENGTH;
   static const int COMMAND_RESPONSE_BYTES;
   static const int PACKET_TIMEOUT;
+  static const double AUX_WAIT;
   static const int SLEEP_TIME_USEC;
   static const int PAN_THRESH;
   static const int TILT_THRESH;
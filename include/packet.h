@@ -36,6 +36,13 @@ class P2OSPacket
   unsigned char packet[PACKET_LEN];
   unsigned char size;
   ros::Time timestamp;
+  // monotonic time (ns) the header was found, see Metrics::Now()
+  uint64_t headerTime;
+  // what the last Receive() had to throw away before it got a good packet:
+  // stray bytes while hunting for the header, and packets that failed the
+  // checksum
+  unsigned int skipped;
+  unsigned int badChecksums;
 
   int CalcChkSum();
 
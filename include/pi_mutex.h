@@ -0,0 +1,56 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _PI_MUTEX_H
+#define _PI_MUTEX_H
+
+#include <pthread.h>
+
+#include <boost/thread/locks.hpp>
+
+// A recursive mutex with priority inheritance: while the real-time control
+// loop waits for it, whichever thread holds it runs at the loop's priority,
+// so a callback at normal priority cannot be preempted indefinitely in the
+// middle of its critical section.  It has the usual lock()/unlock(), so the
+// boost lock types and condition_variable_any work with it.
+class PiMutex
+{
+  public:
+    typedef boost::unique_lock<PiMutex> scoped_lock;
+
+    PiMutex();
+    ~PiMutex();
+
+    void lock();
+    bool try_lock();
+    void unlock();
+
+  private:
+    // not copyable
+    PiMutex( const PiMutex & );
+    PiMutex &operator=( const PiMutex & );
+
+    pthread_mutex_t mutex_;
+};
+
+#endif
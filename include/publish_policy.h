@@ -0,0 +1,64 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _PUBLISH_POLICY_H
+#define _PUBLISH_POLICY_H
+
+#include "ros/ros.h"
+
+// Decides, once per SIP, whether an output topic is worth filling and
+// publishing: it needs a subscriber, and no more than one message is sent
+// per period.  In on-change mode a message is only sent when the value it
+// is built from differs from the last one published, or when the heartbeat
+// period has passed without a message; those topics are latched, so they are
+// published with or without subscribers and a late subscriber's latched
+// message is never older than the heartbeat.
+class PublishPolicy
+{
+  public:
+    PublishPolicy() : period_(0.0), on_change_(false), heartbeat_(0.0), last_value_(0) {}
+
+    // rate is the maximum publish rate in Hz; 0 publishes on every SIP.
+    // heartbeat is in seconds; 0 only publishes on change.  An empty
+    // publisher counts as always subscribed (e.g. for tf broadcasts).
+    void Init( const ros::Publisher &pub, double rate,
+               bool on_change = false, double heartbeat = 0.0 );
+
+    // value is a cheap summary of the raw data the message is built from
+    bool Due( const ros::Time &now, unsigned int value = 0 ) const;
+    void Published( const ros::Time &now, unsigned int value = 0 )
+    {
+        last_ = now;
+        last_value_ = value;
+    }
+
+  private:
+    ros::Publisher pub_;
+    ros::Duration  period_;
+    bool           on_change_;
+    ros::Duration  heartbeat_;
+    ros::Time      last_;
+    unsigned int   last_value_;
+};
+
+#endif
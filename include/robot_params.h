@@ -196,6 +196,7 @@ enum P2OSCommand {
 #define GYROPAC         0x98    // Added AROS 1.8
 #define ARMPAC    160   // ARMpac
 #define ARMINFOPAC  161   // ARMINFOpac
+#define CONFIGPAC 0x20  // CONFIGpac, the reply to CONFIG
 //#define PLAYLIST  0xD0
 
 /* Argument types */
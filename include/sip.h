@@ -38,6 +38,14 @@ typedef struct ArmJoint
 	unsigned char ticksPer90;
 } ArmJoint;
 
+// The settings in a CONFIGpac that the driver can change at connect time,
+// in the robot's own units
+typedef struct RobotConfig
+{
+    unsigned short rotAccel, rotDecel, rotKP, rotKV, rotKI;
+    unsigned short transAccel, transDecel, transKP, transKV, transKI;
+} RobotConfig;
+
 enum PlayerGripperStates {
     PLAYER_GRIPPER_STATE_OPEN = 1,
     PLAYER_GRIPPER_STATE_CLOSED,
@@ -51,10 +59,23 @@ enum PlayerActArrayStates {
     PLAYER_ACTARRAY_ACTSTATE_STALLED
 };
 
+// Parts of ros_p2os_data_t that FillStandard() should bring up to date
+enum SIPFillFields {
+    FILL_ODOM    = 0x01,
+    FILL_BATTERY = 0x02,
+    FILL_MOTORS  = 0x04,
+    FILL_SONAR   = 0x08,
+    FILL_GRIPPER = 0x10,
+    FILL_DIO     = 0x20,
+    FILL_AIO     = 0x40,
+    FILL_ALL     = 0x7F
+};
+
 class SIP
 {
   private:
-    int PositionChange( unsigned short, unsigned short );
+    bool PositionChange( unsigned short, unsigned short, double, double, int* );
+    void ResizeSonars( int );
     int param_idx; // index of our robot's data in the parameter table
 
   public:
@@ -62,13 +83,30 @@ class SIP
     bool lwstall, rwstall;
 		unsigned char  motors_enabled, sonar_flag;
     unsigned char status, battery, sonarreadings, analog, digin, digout;
+    int sonarcapacity; // size of the sonar arrays; sonarreadings <= this
     unsigned short ptu, compass, timer, rawxpos;
     unsigned short rawypos, frontbumpers, rearbumpers;
     short angle, lvel, rvel, control;
     unsigned short *sonars;
+    ros::Time *sonarStamps;   // when each sonar was last reported
+    unsigned int *sonarSeqs;  // how many times each sonar has been reported
+    uint32_t sonarsUpdated;   // bit i is set if sonar i has been reported
+                              // since the node last published; it clears it
     int xpos, ypos;
     int x_offset,y_offset,angle_offset;
 
+    // odometry updates that could not be reconciled with the wheel
+    // velocities, and updates recovered from more than one counter wrap
+    unsigned int odomRejected, odomRecovered;
+
+    // The robot's SIP cycle (s), 100 ms unless the CONFIGpac says otherwise.
+    // A SIP read later than this after the previous one may stand for up to
+    // maxLateCycles cycles of motion (the odom_max_late_cycles parameter).
+    double sipCycle;
+    int maxLateCycles;
+    // standard SIPs parsed so far; the robot sends one every sipCycle
+    unsigned int sipCount;
+
     // these values are returned in a CMUcam serial string extended SIP
     // (in host byte-order)
     unsigned short blobmx, blobmy;	// Centroid
@@ -89,36 +127,50 @@ class SIP
     unsigned char armNumJoints;
     ArmJoint *armJoints;
 
+    // This comes from the CONFIGpac
+    bool configReceived;
+    RobotConfig config;
+
     // Need this value to calculate approx position of lift when in between up
     // and down
     double lastLiftPos;
 
     //Timestamping SIP packets
-    //double timeStandardSIP, timeGyro, timeSERAUX, timeArm;
+    ros::Time timeStandardSIP;
+
+    // The SIP dump goes to the "sip" logger at debug level, at most once
+    // per printPeriod seconds (0 = every SIP)
+    double printPeriod;
+    //double timeGyro, timeSERAUX, timeArm;
 
     /* returns 0 if Parsed correctly otherwise 1 */
-    void ParseStandard( unsigned char *buffer );
+    void ParseStandard( unsigned char *buffer, const ros::Time &ts );
     void ParseSERAUX( unsigned char *buffer );
     void ParseGyro(unsigned char* buffer);
     void ParseArm (unsigned char *buffer);
     void ParseArmInfo (unsigned char *buffer);
+    void ParseConfig (unsigned char *buffer);
+    std::string Dump();
     void Print();
-    void PrintSonars();
     void PrintArm ();
     void PrintArmInfo ();
-    void FillStandard(ros_p2os_data_t* data);
+    void FillStandard(ros_p2os_data_t* data, unsigned int fields = FILL_ALL);
     //void FillSERAUX(player_p2os_data_t* data);
     //void FillGyro(player_p2os_data_t* data);
     //void FillArm(player_p2os_data_t* data);
 
     SIP(int idx) :
-            param_idx(idx), sonarreadings(0), sonars(NULL),
+            param_idx(idx), sonarreadings(0), sonarcapacity(0),
+            rawxpos(0), rawypos(0), angle(0), lvel(0), rvel(0), sonars(NULL),
+            sonarStamps(NULL), sonarSeqs(NULL), sonarsUpdated(0),
             xpos(0), ypos(0), x_offset(0), y_offset(0), angle_offset(0),
+            odomRejected(0), odomRecovered(0), sipCycle(0.1), maxLateCycles(10),
+            sipCount(0),
             blobmx(0), blobmy(0), blobx1(0), blobx2(0), bloby1(0), bloby2(0),
             blobarea(0), blobconf(0), blobcolor(0),
             armPowerOn(false), armConnected(false), armVersionString(NULL),
-            armNumJoints(0), armJoints(NULL),
-            lastLiftPos(0.0f)
+            armNumJoints(0), armJoints(NULL), configReceived(false),
+            lastLiftPos(0.0f), printPeriod(1.0)
     {
         for (int i = 0; i < 6; ++i)
         {
@@ -127,11 +179,17 @@ class SIP
             armJointPosRads[i] = 0;
             armJointTargetPos[i] = 0;
         }
+
+        // Size the sonar arrays for this robot up front so the parser never
+        // has to allocate
+        ResizeSonars(PlayerRobotParams[param_idx].SonarNum);
     }
 
     ~SIP(void)
     {
         delete[] sonars;
+        delete[] sonarStamps;
+        delete[] sonarSeqs;
     }
 };
 
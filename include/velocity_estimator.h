@@ -0,0 +1,73 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _VELOCITY_ESTIMATOR_H
+#define _VELOCITY_ESTIMATOR_H
+
+#include <string>
+
+#include "ros/ros.h"
+#include "nav_msgs/Odometry.h"
+
+// Estimates the robot's body velocity once per SIP.  The wheel speeds in the
+// SIP are coarse (integer mm/s) and noisy, while the pose is only reported to
+// the nearest mm and degree, so the two can be used on their own or fused by
+// weighting each with the inverse of its variance.  The result is then
+// passed through a first-order low-pass filter and published with the
+// variance that is left.
+class VelocityEstimator
+{
+  public:
+    enum Mode { WHEELS, POSE, FUSED };
+
+    VelocityEstimator();
+
+    // mode is "wheels", "pose" or "fused"; cutoff is the low-pass filter
+    // cutoff frequency in Hz (0 = no filtering).  Variances are of a single
+    // unfiltered estimate, in (m/s)^2 and (rad/s)^2.  Returns false if the
+    // mode isn't recognised, in which case the wheel speeds are used.
+    bool Init( const std::string &mode, double cutoff,
+               double wheel_linear_var, double wheel_angular_var,
+               double pose_linear_var, double pose_angular_var );
+
+    // odom holds this SIP's pose and the wheel-speed twist; the twist and
+    // its covariance are replaced with the estimate.  dt is the robot's time
+    // since the last update (SIP cycles elapsed times the SIP cycle): SIPs
+    // queued behind a host stall are read back to back, so ts only serves
+    // to notice a gap, e.g. after a reconnect.
+    void Update( const ros::Time &ts, double dt, nav_msgs::Odometry &odom );
+
+    // forget the last pose, e.g. after the odometry has been reset
+    void Reset() { last_ = ros::Time(); }
+
+  private:
+    Mode   mode_;
+    double tau_;
+    double wheel_var_[2], pose_var_[2];
+
+    ros::Time last_;
+    double last_x_, last_y_, last_th_;
+    double vel_[2], var_[2];
+};
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _VELOCITY_SMOOTHER_H
+#define _VELOCITY_SMOOTHER_H
+
+// Below this many updates a second the setpoints become coarse steps that
+// the robot's own ramp, not the jerk limit, shapes
+#define SMOOTHER_MIN_RATE 20.0
+
+// Turns velocity targets into setpoints that reach them with limited
+// acceleration and jerk, for as many axes as there are limits.  Each axis
+// accelerates as hard as the jerk limit allows while still being able to
+// bring the acceleration back to zero as it arrives at the target.
+class VelocitySmoother
+{
+  public:
+    enum { AXES = 3 };
+
+    VelocitySmoother();
+
+    // accel and jerk limits per axis, in the units of the targets per s
+    // and per s^2; a limit of 0 leaves that axis unsmoothed
+    void Init( const double accel[AXES], const double jerk[AXES] );
+
+    // the robot is known to be at rest, e.g. after an emergency stop
+    void Reset();
+
+    // steps the setpoints dt seconds towards targets[] and writes them back
+    // into targets[]; from one step to the next the acceleration changes by
+    // at most the jerk limit times dt, the arriving step included
+    void Update( double dt, double targets[AXES] );
+
+    // whether every axis has reached its last target and stopped
+    // accelerating, which takes one more step after arriving
+    bool Settled() const;
+
+  private:
+    double accel_[AXES], jerk_[AXES];
+    double vel_[AXES], acc_[AXES], target_[AXES];
+};
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <math.h>
+
+#include <command_filter.h>
+
+CommandFilter::CommandFilter() :
+    sent(0), suppressed(0),
+    hysteresis_(0.25), min_interval_(0.0),
+    axes_((1 << AXIS_X) | (1 << AXIS_YAW)), pending_(false)
+{
+    Reset();
+}
+
+void CommandFilter::Init( double hysteresis, double min_interval )
+{
+    hysteresis_ = hysteresis > 0.0 ? hysteresis : 0.0;
+    min_interval_ = min_interval > 0.0 ? min_interval : 0.0;
+    Reset();
+}
+
+void CommandFilter::Reset()
+{
+    pending_ = false;
+    for( int i = 0; i < AXIS_COUNT; i++ )
+    {
+        valid_[i] = false;
+        last_[i] = 0;
+        last_time_[i] = 0.0;
+    }
+}
+
+unsigned int CommandFilter::Update( double now, const double targets[AXIS_COUNT],
+                                    int values[AXIS_COUNT] )
+{
+    unsigned int axes = 0;
+
+    pending_ = false;
+    for( int i = 0; i < AXIS_COUNT; i++ )
+    {
+        values[i] = (int)rint(targets[i]);
+        if( !(axes_ & (1 << i)) )
+            continue;
+
+        if( valid_[i] )
+        {
+            bool stop = (values[i] == 0 && last_[i] != 0);
+            if( !stop && fabs(targets[i] - last_[i]) <= 0.5 + hysteresis_ )
+            {
+                suppressed++;
+                continue;
+            }
+            if( !stop && now - last_time_[i] < min_interval_ )
+            {
+                pending_ = true;
+                continue;
+            }
+        }
+
+        valid_[i] = true;
+        last_[i] = values[i];
+        last_time_[i] = now;
+        axes |= (1 << i);
+        sent++;
+    }
+
+    return axes;
+}
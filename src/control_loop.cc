@@ -0,0 +1,148 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <sched.h>
+#include <pthread.h>
+
+#include <ros/ros.h>
+
+#include <control_loop.h>
+
+// Controllers and the commands they produce
+void send_commands( P2OSNode *p, controller_manager::ControllerManager &cm, ros::Duration period )
+{
+    // controllers run first so a base command goes out this cycle
+    p->check_and_set_controllers(ros::Time::now(),period,cm);
+    p->check_and_set_vel();
+    p->check_and_set_motor_state();
+    p->check_and_set_gripper_state();
+
+    p->check_and_send_pulse();
+}
+
+// One pass of the control loop: controllers, commands and the SIP exchange
+void control_cycle( P2OSNode *p, controller_manager::ControllerManager &cm, ros::Rate &rate )
+{
+    {
+        PiMutex::scoped_lock lock(p->get_state_mutex());
+
+        p->CycleStarted();
+
+        send_commands(p, cm, rate.cycleTime());
+    }
+
+    // Listen at a constant rate
+    if( p->get_drain_sips() )
+    {
+        // catch up with whatever has queued since the last cycle
+        uint64_t ready;
+        int waited = p->WaitForData(0.0, ready);
+        p->ReceiveSIP(ready, waited > 0);
+    }
+    else
+    {
+        p->SendReceive(NULL,true);
+    }
+}
+
+// One pass of the SIP-locked loop: wait for the robot's next SIP, publish
+// it and answer with this cycle's commands straight away
+void sip_locked_cycle( P2OSNode *p, controller_manager::ControllerManager &cm, ros::Time &last )
+{
+    // not holding the lock while waiting lets the callbacks run meanwhile;
+    // if the robot goes quiet the commands still go out every two periods,
+    // or sooner when the cmd_vel watchdog is due to stop the robot
+    double wait = 2.0 / p->get_frequency();
+    double deadline = p->TimeToCmdVelTimeout();
+    if( deadline >= 0.0 )
+        wait = std::min(wait, deadline);
+    uint64_t ready;
+    int waited = p->WaitForData(wait, ready);
+    if( waited >= 0 )
+        p->ReceiveSIP(ready, waited > 0);
+
+    PiMutex::scoped_lock lock(p->get_state_mutex());
+
+    p->CycleStarted();
+
+    ros::Time now = ros::Time::now();
+    send_commands(p, cm, now - last);
+    last = now;
+}
+
+// Shuts the node down when the control thread ends, however it ends
+struct ControlThreadGuard
+{
+    ~ControlThreadGuard() { ros::shutdown(); }
+};
+
+// The control loop on a thread of its own, at SCHED_FIFO priority and
+// optionally pinned to one CPU
+void control_thread( P2OSNode *p, controller_manager::ControllerManager *cm,
+                     int priority, int cpu )
+{
+    ControlThreadGuard guard;
+
+    struct sched_param param;
+    param.sched_priority = priority;
+    if( pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0 )
+        ROS_WARN( "Could not set SCHED_FIFO priority %d for the control loop", priority );
+
+    if( cpu >= 0 )
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if( pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0 )
+            ROS_WARN( "Could not pin the control loop to CPU %d", cpu );
+    }
+
+    // fault in the stack now rather than on the first deep call
+    volatile unsigned char stack[64 * 1024];
+    for( size_t i = 0; i < sizeof(stack); i += 4096 )
+        stack[i] = 0;
+
+    ros::Rate rate(p->get_frequency());
+    ros::Time last = ros::Time::now();
+    while( ros::ok() )
+    {
+        if( p->get_sip_locked() )
+        {
+            sip_locked_cycle(p, *cm, last);
+        }
+        else
+        {
+            control_cycle(p, *cm, rate);
+            rate.sleep();
+        }
+    }
+}
+
+// Publishes what the control loop fills in, so the real-time thread does
+// not spend its time in roscpp
+void publish_thread( P2OSNode *p )
+{
+    while( ros::ok() )
+        p->PublishPending(0.1);
+}
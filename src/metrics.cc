@@ -0,0 +1,221 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sstream>
+
+#include <ros/ros.h>
+
+#include <metrics.h>
+
+// A client gets this long (s) to send its request and take the answer
+#define METRICS_CLIENT_TIMEOUT 2
+
+static const char *stage_names[Metrics::STAGE_COUNT] =
+    { "read", "frame", "parse", "fill", "publish", "cycle" };
+
+static const char *counter_names[Metrics::COUNTER_COUNT] =
+    { "p2os_packets_total", "p2os_sips_total", "p2os_commands_sent_total",
+      "p2os_checksum_failures_total", "p2os_bytes_skipped_total",
+      "p2os_unexpected_packets_total", "p2os_coalesced_sips_total" };
+
+LatencyHistogram::LatencyHistogram()
+{
+    for( int i = 0; i < METRICS_BUCKETS; i++ )
+        buckets_[i].store(0, boost::memory_order_relaxed);
+    count_.store(0, boost::memory_order_relaxed);
+    sum_ns_.store(0, boost::memory_order_relaxed);
+}
+
+void LatencyHistogram::Record( uint64_t ns )
+{
+    // bucket i holds samples below 2^i us
+    uint64_t us = ns / 1000;
+    int bucket = 0;
+    while( bucket < METRICS_BUCKETS - 1 && us >= (1ULL << bucket) )
+        bucket++;
+
+    buckets_[bucket].fetch_add(1, boost::memory_order_relaxed);
+    count_.fetch_add(1, boost::memory_order_relaxed);
+    sum_ns_.fetch_add(ns, boost::memory_order_relaxed);
+}
+
+void LatencyHistogram::Write( std::ostream &out, const char *name, const char *stage ) const
+{
+    uint64_t cumulative = 0;
+    for( int i = 0; i < METRICS_BUCKETS - 1; i++ )
+    {
+        cumulative += buckets_[i].load(boost::memory_order_relaxed);
+        out << name << "_bucket{stage=\"" << stage << "\",le=\""
+            << (1ULL << i) * 1e-6 << "\"} " << cumulative << "\n";
+    }
+    cumulative += buckets_[METRICS_BUCKETS - 1].load(boost::memory_order_relaxed);
+    out << name << "_bucket{stage=\"" << stage << "\",le=\"+Inf\"} " << cumulative << "\n";
+    out << name << "_sum{stage=\"" << stage << "\"} "
+        << sum_ns_.load(boost::memory_order_relaxed) * 1e-9 << "\n";
+    out << name << "_count{stage=\"" << stage << "\"} "
+        << count_.load(boost::memory_order_relaxed) << "\n";
+}
+
+Metrics::Metrics() :
+    enabled_(false), listen_fd_(-1), client_fd_(-1), stopping_(false)
+{
+    for( int i = 0; i < COUNTER_COUNT; i++ )
+        counters_[i].store(0, boost::memory_order_relaxed);
+}
+
+Metrics::~Metrics()
+{
+    Stop();
+}
+
+void Metrics::Write( std::ostream &out ) const
+{
+    // enough digits to print the bucket bounds exactly
+    out.precision(9);
+    out << "# TYPE p2os_stage_seconds histogram\n";
+    for( int i = 0; i < STAGE_COUNT; i++ )
+        stages_[i].Write(out, "p2os_stage_seconds", stage_names[i]);
+
+    for( int i = 0; i < COUNTER_COUNT; i++ )
+    {
+        out << "# TYPE " << counter_names[i] << " counter\n";
+        out << counter_names[i] << " " << counters_[i].load(boost::memory_order_relaxed) << "\n";
+    }
+}
+
+int Metrics::Start( int port )
+{
+    struct sockaddr_in addr;
+    int on = 1;
+
+    if( (listen_fd_ = socket(AF_INET, SOCK_STREAM, 0)) < 0 )
+    {
+        ROS_ERROR("Metrics: could not open socket");
+        return 1;
+    }
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    // only reachable from the robot itself
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if( bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd_, 4) < 0 )
+    {
+        ROS_ERROR("Metrics: could not listen on 127.0.0.1:%d", port);
+        close(listen_fd_);
+        listen_fd_ = -1;
+        return 1;
+    }
+
+    enabled_ = true;
+    thread_ = boost::thread(&Metrics::Serve, this);
+    ROS_INFO("Serving metrics on http://127.0.0.1:%d/metrics", port);
+    return 0;
+}
+
+void Metrics::Stop()
+{
+    if( listen_fd_ < 0 )
+        return;
+
+    // wakes the server thread up out of accept(), or out of a read or write
+    // on a connection it is answering
+    {
+        boost::mutex::scoped_lock lock(client_mutex_);
+        stopping_ = true;
+        if( client_fd_ >= 0 )
+            shutdown(client_fd_, SHUT_RDWR);
+    }
+    shutdown(listen_fd_, SHUT_RDWR);
+    thread_.join();
+    close(listen_fd_);
+    listen_fd_ = -1;
+}
+
+void Metrics::Serve()
+{
+    char request[1024];
+
+    while( true )
+    {
+        int fd = accept(listen_fd_, NULL, NULL);
+        if( fd < 0 )
+            break;
+
+        // a client that connects and then says nothing must not hold the
+        // endpoint up
+        struct timeval timeout;
+        timeout.tv_sec = METRICS_CLIENT_TIMEOUT;
+        timeout.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        {
+            boost::mutex::scoped_lock lock(client_mutex_);
+            if( stopping_ )
+            {
+                close(fd);
+                break;
+            }
+            client_fd_ = fd;
+        }
+
+        // whatever was asked for, the answer is the same
+        if( read(fd, request, sizeof(request)) >= 0 )
+        {
+            std::ostringstream body;
+            Write(body);
+
+            std::ostringstream response;
+            response << "HTTP/1.0 200 OK\r\n"
+                     << "Content-Type: text/plain; version=0.0.4\r\n"
+                     << "Content-Length: " << body.str().size() << "\r\n\r\n"
+                     << body.str();
+
+            std::string text = response.str();
+            size_t sent = 0;
+            while( sent < text.size() )
+            {
+                ssize_t n = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+                if( n <= 0 )
+                    break;
+                sent += n;
+            }
+        }
+
+        {
+            boost::mutex::scoped_lock lock(client_mutex_);
+            client_fd_ = -1;
+        }
+        close(fd);
+    }
+}
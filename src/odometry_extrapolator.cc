@@ -0,0 +1,148 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include <tf/tf.h>
+
+#include <odometry_extrapolator.h>
+
+// Integration step (s) when carrying the pose forward
+#define EXTRAPOLATION_STEP 0.005
+
+OdometryExtrapolator::OdometryExtrapolator() :
+    rate_(0.0), time_constant_(0.0), horizon_(0.0), have_odom_(false)
+{
+    cmd_[0] = cmd_[1] = 0.0;
+}
+
+OdometryExtrapolator::~OdometryExtrapolator()
+{
+    Stop();
+}
+
+void OdometryExtrapolator::Start( ros::NodeHandle &n, const std::string &topic,
+                                  const std::string &frame_id,
+                                  const std::string &child_frame_id,
+                                  double rate, double time_constant, double horizon )
+{
+    if( rate <= 0.0 )
+        return;
+
+    odom_.header.frame_id = frame_id;
+    odom_.child_frame_id = child_frame_id;
+    rate_ = rate;
+    time_constant_ = time_constant > 0.0 ? time_constant : 0.0;
+    horizon_ = horizon > 0.0 ? horizon : 0.0;
+    pub_ = n.advertise<nav_msgs::Odometry>(topic, 1);
+    thread_ = boost::thread(&OdometryExtrapolator::Run, this);
+}
+
+void OdometryExtrapolator::Stop()
+{
+    thread_.interrupt();
+    thread_.join();
+}
+
+void OdometryExtrapolator::Update( const ros::Time &ts, const nav_msgs::Odometry &odom,
+                                   double cmd_vx, double cmd_va )
+{
+    if( rate_ <= 0.0 )
+        return;
+
+    boost::mutex::scoped_lock lock(mutex_);
+    stamp_ = ts;
+    pose_ = odom.pose;
+    twist_ = odom.twist;
+    cmd_[0] = cmd_vx;
+    cmd_[1] = cmd_va;
+    have_odom_ = true;
+}
+
+void OdometryExtrapolator::Run()
+{
+    ros::Rate rate(rate_);
+    nav_msgs::Odometry &odom = odom_;
+    double cmd[2];
+
+    try
+    {
+        while( ros::ok() )
+        {
+            boost::this_thread::interruption_point();
+            rate.sleep();
+
+            if( pub_.getNumSubscribers() == 0 )
+                continue;
+
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                if( !have_odom_ )
+                    continue;
+                odom.header.stamp = stamp_;
+                odom.pose = pose_;
+                odom.twist = twist_;
+                cmd[0] = cmd_[0];
+                cmd[1] = cmd_[1];
+            }
+
+            ros::Time now = ros::Time::now();
+            double span = (now - odom.header.stamp).toSec();
+            span = std::max(std::min(span, horizon_), 0.0);
+
+            double x = odom.pose.pose.position.x;
+            double y = odom.pose.pose.position.y;
+            double th = tf::getYaw(odom.pose.pose.orientation);
+            double vel[2];
+            vel[0] = odom.twist.twist.linear.x;
+            vel[1] = odom.twist.twist.angular.z;
+
+            // first-order lag from the measured towards the commanded velocity
+            double decay = time_constant_ > 0.0 ?
+                exp(-EXTRAPOLATION_STEP / time_constant_) : 1.0;
+            for( double t = 0.0; t < span; t += EXTRAPOLATION_STEP )
+            {
+                double dt = std::min(EXTRAPOLATION_STEP, span - t);
+                double mid = th + vel[1] * dt / 2.0;
+                x += vel[0] * dt * cos(mid);
+                y += vel[0] * dt * sin(mid);
+                th += vel[1] * dt;
+                for( int i = 0; i < 2; i++ )
+                    vel[i] = cmd[i] + (vel[i] - cmd[i]) * decay;
+            }
+
+            // past the horizon the pose is older than now, so say so
+            odom.header.stamp += ros::Duration(span);
+            odom.pose.pose.position.x = x;
+            odom.pose.pose.position.y = y;
+            odom.pose.pose.orientation = tf::createQuaternionMsgFromYaw(th);
+            odom.twist.twist.linear.x = vel[0];
+            odom.twist.twist.angular.z = vel[1];
+            pub_.publish(odom);
+        }
+    }
+    catch( boost::thread_interrupted & )
+    {
+    }
+}
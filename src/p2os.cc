@@ -28,10 +28,13 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <poll.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
 #include <ros/ros.h>
 
+#include <algorithm>
+
 #include <p2os.h>
 #include <angles/angles.h>
 
@@ -39,8 +42,13 @@
 
 P2OSNode::P2OSNode( ros::NodeHandle nh ) :
     n(nh),
+    vel_dirty(false),
+    motor_dirty(false),
     gripper_dirty_(false),
-    batt_pub_( n.advertise<p2os_driver::BatteryState>("battery_state",1000),
+    cycle_start_(0),
+    last_odom_rejected_(0),
+    batt_pub_( n.advertise<p2os_driver::BatteryState>("battery_state",1000,
+                   ros::NodeHandle("~").param("publish_on_change", false)),
                diagnostic_,
                diagnostic_updater::FrequencyStatusParam( &frequency, &frequency, 0.1),
                diagnostic_updater::TimeStampStatusParam() ),
@@ -50,15 +58,104 @@ P2OSNode::P2OSNode( ros::NodeHandle nh ) :
     // Use sonar
     ros::NodeHandle n_private("~");
     n_private.param( "use_sonar", use_sonar_, false);
+    // Also publish one sensor_msgs/Range per transducer on "sonar"
+    n_private.param( "publish_sonar_range", publish_sonar_range_, false);
+    // Readings at or beyond this range (m) are left out of the sonar cloud
+    n_private.param( "sonar_max_range", sonar_max_range_, 5.0);
     n_private.param( "use_arm",use_arm_, false);
+    // Expose the wheels as velocity joints to ros_control (e.g. for
+    // diff_drive_controller) instead of taking cmd_vel directly
+    n_private.param( "use_base_controller", use_base_controller_, false);
+    n_private.param( "wheel_radius", wheel_radius_, 0.0975);
+    // Stop the robot if no cmd_vel arrives for cmd_vel_timeout seconds
+    // (0 = never), either by commanding zero velocity so it ramps down at the
+    // configured deceleration ("stop") or with an emergency stop ("estop")
+    std::string timeout_action;
+    n_private.param( "cmd_vel_timeout", cmdvel_timeout_, 0.0);
+    n_private.param<std::string>( "cmd_vel_timeout_action", timeout_action, "stop");
+    cmdvel_timeout_estop_ = (timeout_action == "estop");
+    if( !cmdvel_timeout_estop_ && timeout_action != "stop" )
+        ROS_WARN( "Unknown cmd_vel_timeout_action \"%s\", using \"stop\"", timeout_action.c_str() );
+    cmdvel_last_ = 0;
+    cmdvel_timed_out_ = false;
+    cmdvel_timeouts_ = 0;
+
+    // Velocity commands are rounded to the firmware's 1 mm/s and 1 deg/s and
+    // only sent when they change by more than half a unit plus
+    // cmd_vel_hysteresis units, and no more often than cmd_vel_min_interval
+    double hysteresis, min_interval;
+    n_private.param( "cmd_vel_hysteresis", hysteresis, 0.25);
+    n_private.param( "cmd_vel_min_interval", min_interval, 0.0);
+    cmd_filter_.Init( hysteresis, min_interval );
+
+    // Optionally ramp towards each cmd_vel with limited acceleration and
+    // jerk, stepping the setpoint on every loop (see frequency)
+    double accel[VelocitySmoother::AXES], jerk[VelocitySmoother::AXES];
+    double lim;
+    n_private.param( "smooth_cmd_vel", smooth_cmd_vel_, false);
+    n_private.param( "smoother_max_xaccel", lim, 0.5);
+    accel[CommandFilter::AXIS_X] = lim * 1e3;
+    n_private.param( "smoother_max_xjerk", lim, 2.0);
+    jerk[CommandFilter::AXIS_X] = lim * 1e3;
+    n_private.param( "smoother_max_yaccel", lim, 0.5);
+    accel[CommandFilter::AXIS_Y] = lim * 1e3;
+    n_private.param( "smoother_max_yjerk", lim, 2.0);
+    jerk[CommandFilter::AXIS_Y] = lim * 1e3;
+    n_private.param( "smoother_max_yawaccel", lim, 1.5);
+    accel[CommandFilter::AXIS_YAW] = RTOD(lim);
+    n_private.param( "smoother_max_yawjerk", lim, 6.0);
+    jerk[CommandFilter::AXIS_YAW] = RTOD(lim);
+    smoother_.Init( accel, jerk );
+    smoother_last_ = 0.0;
+
+    // The raw SIP dump is logged to the "sip" logger (debug level) at most
+    // once every sip_debug_period seconds
+    n_private.param( "sip_debug_period", sip_debug_period_, 1.0);
+
+    // A SIP read late may stand for up to odom_max_late_cycles SIP cycles of
+    // motion when the position counters are checked for wraps
+    n_private.param( "odom_max_late_cycles", odom_max_late_cycles_, 10);
+    if( odom_max_late_cycles_ < 1 )
+    {
+        ROS_WARN( "odom_max_late_cycles must be at least 1, using 1" );
+        odom_max_late_cycles_ = 1;
+    }
+
+    // Frame ids, resolved against tf_prefix here so that several robots can
+    // run side by side.  Sonar frames are <sonar_frame_prefix><n>, n from 1.
+    tf_prefix_ = tf::getPrefixParam(n_private);
+    n_private.param<std::string>( "odom_frame_id", odom_frame_id_, "odom");
+    n_private.param<std::string>( "base_frame_id", base_frame_id_, "base_link");
+    n_private.param<std::string>( "sonar_frame_prefix", sonar_frame_prefix_, "Sonar_");
+    odom_frame_id_ = tf::resolve(tf_prefix_, odom_frame_id_);
+    base_frame_id_ = tf::resolve(tf_prefix_, base_frame_id_);
 
     // read in config options
     // bumpstall
     n_private.param( "bumpstall", bumpstall, -1 );
     // Communication Frequency
     n_private.param( "frequency", frequency, 10.0);
+    // Run the control loop off the robot's SIPs rather than at frequency:
+    // each cycle waits for the next SIP, publishes the newest one queued and
+    // then sends its commands
+    n_private.param( "sip_locked", sip_locked_, false );
+    // At the fixed rate, read everything queued each cycle and publish only
+    // the newest SIP, so a loop that falls behind catches up again
+    n_private.param( "drain_sips", drain_sips_, false );
+    if( smooth_cmd_vel_ && !sip_locked_ && frequency < SMOOTHER_MIN_RATE )
+        ROS_WARN( "smooth_cmd_vel steps once a loop; at a frequency of %.1f Hz "
+                  "(below %.0f Hz) its ramps are coarse and the jerk limit only "
+                  "holds from step to step", frequency, SMOOTHER_MIN_RATE );
+    send_only_ = false;
+    defer_publish_ = false;
+    publish_pending_ = false;
+    publish_fields_ = 0;
     // pulse
     n_private.param( "pulse", pulse, 5.0 );
+    // Keepalive period in seconds; any command sent resets it, so pulses
+    // only go out while the link is otherwise idle.  Defaults to the old
+    // pulse-every-n-cycles spacing.
+    n_private.param( "pulse_period", pulse_period, pulse / frequency );
     // rot_kp
     n_private.param( "rot_kp", rot_kp, -1 );
     // rot_kv
@@ -82,12 +179,18 @@ P2OSNode::P2OSNode( ros::NodeHandle nh ) :
     n_private.param( "radio", radio_modemp, 0 );
     // joystick
     n_private.param( "joystick", joystick, 0 );
-    // direct_wheel_vel_control
+    // direct_wheel_vel_control: drive differential robots with one VEL2
+    // (left/right wheel speed) packet instead of VEL and RVEL; VEL2 is in
+    // steps of the robot's Vel2Divisor mm/s, coarser than VEL and RVEL
     n_private.param( "direct_wheel_vel_control", direct_wheel_vel_control, 0 );
+    vel2_sent_ = false;
     // max xpeed
     double spd;
     n_private.param( "max_xspeed", spd, MOTOR_DEF_MAX_SPEED);
     motor_max_speed = (int)rint(1e3*spd);
+    // max_yspeed (holonomic robots only)
+    n_private.param( "max_yspeed", spd, MOTOR_DEF_MAX_SPEED);
+    motor_max_latspeed = (int)rint(1e3*spd);
     // max_yawspeed
     n_private.param( "max_yawspeed", spd, MOTOR_DEF_MAX_TURNSPEED);
     motor_max_turnspeed = (short)rint(RTOD(spd));
@@ -104,30 +207,120 @@ P2OSNode::P2OSNode( ros::NodeHandle nh ) :
     n_private.param( "max_yawdecel", spd, 0.0);
     motor_max_rot_decel = (short)rint(RTOD(spd));
 
+    // Slow-moving state (battery, motors, gripper, aio, dio) can be sent only
+    // when it changes, plus a heartbeat every heartbeat_period seconds.  Those
+    // topics are latched so late subscribers still get the current state, and
+    // are published even while nobody subscribes so that it stays current.
+    bool on_change;
+    double heartbeat;
+    n_private.param( "publish_on_change", on_change, false );
+    n_private.param( "heartbeat_period", heartbeat, 1.0 );
+
     // advertise services
     pose_pub_       = n.advertise<nav_msgs::Odometry>       ("pose"         ,1000);
-    mstate_pub_     = n.advertise<p2os_driver::MotorState>  ("motor_state"  ,1000);
-    grip_state_pub_ = n.advertise<p2os_driver::GripperState>("gripper_state",1000);
+    mstate_pub_     = n.advertise<p2os_driver::MotorState>  ("motor_state"  ,1000, on_change);
+    grip_state_pub_ = n.advertise<p2os_driver::GripperState>("gripper_state",1000, on_change);
     ptz_state_pub_  = n.advertise<p2os_driver::PTZState>    ("ptz_state"    ,1000);
-    sonar_pub_      = n.advertise<sensor_msgs::Range>       ("sonar"        ,1000);
-    aio_pub_        = n.advertise<p2os_driver::AIO>         ("aio"          ,1000);
-    dio_pub_        = n.advertise<p2os_driver::DIO>         ("dio"          ,1000);
+    sonar_array_pub_= n.advertise<p2os_driver::SonarArray>  ("sonar_array"  ,1000);
+    sonar_cloud_pub_= n.advertise<sensor_msgs::PointCloud2> ("sonar_cloud"  ,1000);
+    if (publish_sonar_range_)
+        sonar_pub_  = n.advertise<sensor_msgs::Range>       ("sonar"        ,1000);
+    aio_pub_        = n.advertise<p2os_driver::AIO>         ("aio"          ,1000, on_change);
+    dio_pub_        = n.advertise<p2os_driver::DIO>         ("dio"          ,1000, on_change);
+
+    // Outputs are only filled in and published when somebody is listening,
+    // and no faster than their *_rate parameter (Hz, 0 = every SIP)
+    double rate;
+    // How the twist in "pose" is worked out: from the wheel speeds
+    // ("wheels"), from differentiated pose ("pose") or both ("fused"),
+    // optionally low-pass filtered
+    std::string estimator;
+    double cutoff, wheel_lin_var, wheel_ang_var, pose_lin_var, pose_ang_var;
+    n_private.param<std::string>( "velocity_estimator", estimator, "wheels" );
+    n_private.param( "velocity_filter_cutoff", cutoff, 0.0 );
+    n_private.param( "wheel_linear_variance", wheel_lin_var, 1e-4 );
+    n_private.param( "wheel_angular_variance", wheel_ang_var, 1e-3 );
+    n_private.param( "pose_linear_variance", pose_lin_var, 4e-4 );
+    n_private.param( "pose_angular_variance", pose_ang_var, 3e-2 );
+    if( !velocity_estimator_.Init( estimator, cutoff, wheel_lin_var, wheel_ang_var,
+                                   pose_lin_var, pose_ang_var ) )
+        ROS_WARN( "Unknown velocity_estimator \"%s\", using wheel speeds", estimator.c_str() );
+    estimator_sips_ = 0;
+
+    // Odometry carried forward from the last SIP at predict_rate Hz (0 = off)
+    // on "pose_predicted", for controllers that run faster than the SIPs
+    double predict_rate, predict_time_constant, predict_horizon;
+    n_private.param( "predict_rate", predict_rate, 0.0 );
+    n_private.param( "predict_time_constant", predict_time_constant, 0.2 );
+    n_private.param( "predict_horizon", predict_horizon, 0.5 );
+    extrapolator_.Start( n, "pose_predicted", odom_frame_id_, base_frame_id_,
+                         predict_rate, predict_time_constant, predict_horizon );
+
+    // Stage timings and counters in Prometheus text format on
+    // http://127.0.0.1:<metrics_port>/ (0 = off)
+    int metrics_port;
+    n_private.param( "metrics_port", metrics_port, 0 );
+    if( metrics_port > 0 )
+        metrics_.Start( metrics_port );
+
+    // Turn publish_tf off when something else (e.g. an EKF) provides the
+    // odom -> base transform
+    n_private.param( "publish_tf", publish_tf_, true );
+    n_private.param( "tf_rate", rate, 0.0 );
+    tf_policy_.Init( ros::Publisher(), rate );
+    n_private.param( "pose_rate", rate, 0.0 );
+    pose_policy_.Init( pose_pub_, rate );
+    n_private.param( "battery_state_rate", rate, 0.0 );
+    batt_policy_.Init( batt_pub_.getPublisher(), rate, on_change, heartbeat );
+    n_private.param( "motor_state_rate", rate, 0.0 );
+    mstate_policy_.Init( mstate_pub_, rate, on_change, heartbeat );
+    n_private.param( "gripper_state_rate", rate, 0.0 );
+    grip_state_policy_.Init( grip_state_pub_, rate, on_change, heartbeat );
+    n_private.param( "ptz_state_rate", rate, 0.0 );
+    ptz_state_policy_.Init( ptz_state_pub_, rate );
+    n_private.param( "aio_rate", rate, 0.0 );
+    aio_policy_.Init( aio_pub_, rate, on_change, heartbeat );
+    n_private.param( "dio_rate", rate, 0.0 );
+    dio_policy_.Init( dio_pub_, rate, on_change, heartbeat );
 
     // subscribe to services
     cmdvel_sub_    = n.subscribe("cmd_vel"        , 1, &P2OSNode::cmdvel_cb      , this);
     cmdmstate_sub_ = n.subscribe("cmd_motor_state", 1, &P2OSNode::cmdmotor_state , this);
     gripper_sub_   = n.subscribe("gripper_control", 1, &P2OSNode::gripperCallback, this);
     sonar_sub_     = n.subscribe("sonar_control"  , 1, &P2OSNode::sonar_cb       , this);
-    ptz_cmd_sub_   = n.subscribe("ptz_control"    , 1, &P2OSPtz::callback        , &ptz_);
+    ptz_cmd_sub_   = n.subscribe("ptz_control"    , 1, &P2OSNode::ptz_cb         , this);
 
     veltime = ros::Time::now();
 
+    // outgoing messages are reused from one SIP to the next, so anything
+    // that never changes is filled in here once
+    p2os_data.position.header.frame_id   = odom_frame_id_;
+    p2os_data.position.child_frame_id    = base_frame_id_;
+    p2os_data.odom_trans.header.frame_id = odom_frame_id_;
+    p2os_data.odom_trans.child_frame_id  = base_frame_id_;
+    p2os_data.sonar.header.frame_id = base_frame_id_;
+
+    // fields of the per-transducer range message that never change
+    sonar_range_.radiation_type = sensor_msgs::Range::ULTRASOUND;
+    sonar_range_.field_of_view = ((15.0)/180.0) * 3.14;
+    sonar_range_.min_range = 0.0;
+    sonar_range_.max_range = 10.0;
+
     // add diagnostic functions
     diagnostic_.add("Motor Stall"    , this, &P2OSNode::check_stall );
     diagnostic_.add("Battery Voltage", this, &P2OSNode::check_voltage );
+    diagnostic_.add("Odometry"       , this, &P2OSNode::check_odometry );
+    diagnostic_.add("Link"           , this, &P2OSNode::check_link );
+    diagnostic_.add("Command Watchdog", this, &P2OSNode::check_cmdvel_watchdog );
+    memset(&link_, 0, sizeof(link_));
+    link_reported_ = link_;
+    link_reported_time_ = ros::Time::now();
 
     // initialize robot parameters (player legacy)
     initialize_robot_params();
+
+    if( use_base_controller_ )
+        base_initialize();
 }
 
 P2OSNode::~P2OSNode()
@@ -135,6 +328,7 @@ P2OSNode::~P2OSNode()
 
 void P2OSNode::cmdmotor_state( const p2os_driver::MotorStateConstPtr &msg)
 {
+    PiMutex::scoped_lock lock(state_mutex_);
     motor_dirty = true;
     cmdmotor_state_ = *msg;
 }
@@ -157,6 +351,12 @@ void P2OSNode::check_and_set_motor_state()
     // Store the current motor state so that we can set it back
     p2os_data.motors.state = cmdmotor_state_.state;
     SendReceive(&packet, false);
+
+    // the robot drops its velocity setpoints, so resend the next command
+    cmd_filter_.Reset();
+    vel2_sent_ = false;
+    smoother_.Reset();
+    vel_dirty = true;
 }
 
 void P2OSNode::check_and_set_gripper_state()
@@ -190,83 +390,201 @@ void P2OSNode::check_and_set_gripper_state()
 
 void P2OSNode::cmdvel_cb( const geometry_msgs::TwistConstPtr &msg)
 {
-    if( fabs( msg->linear.x - cmdvel_.linear.x ) > 0.01 || fabs( msg->angular.z-cmdvel_.angular.z) > 0.01 )
+    // the base controller owns the wheels; two sources would fight
+    if( use_base_controller_ )
     {
-        veltime = ros::Time::now();
-        ROS_DEBUG( "New speed: [%0.2f,%0.2f](%0.3f)", msg->linear.x*1e3, msg->angular.z, veltime.toSec() );
-        vel_dirty = true;
-        cmdvel_ = *msg;
+        ROS_WARN_THROTTLE( 5.0, "Ignoring cmd_vel: the base is driven by the base controller (use_base_controller)" );
+        return;
+    }
+
+    PiMutex::scoped_lock lock(state_mutex_);
+    cmdvel_last_ = Metrics::Now();
+    cmdvel_timed_out_ = false;
+
+    // check_and_set_vel() works out whether this changes anything
+    veltime = ros::Time::now();
+    ROS_DEBUG( "New speed: [%0.2f,%0.2f,%0.2f](%0.3f)", msg->linear.x*1e3, msg->linear.y*1e3,
+               msg->angular.z, veltime.toSec() );
+    vel_dirty = true;
+    cmdvel_ = *msg;
+}
+
+// Whether the last command asks the robot to move
+bool P2OSNode::cmdvel_moving() const
+{
+    return fabs(cmdvel_.linear.x) >= 1e-3 || fabs(cmdvel_.linear.y) >= 1e-3 ||
+           fabs(cmdvel_.angular.z) >= 1e-3;
+}
+
+// Seconds until check_cmdvel_timeout() would stop the robot, or -1 if it
+// has nothing to stop
+double P2OSNode::TimeToCmdVelTimeout()
+{
+    PiMutex::scoped_lock lock(state_mutex_);
+    if( cmdvel_timeout_ <= 0.0 || cmdvel_timed_out_ || cmdvel_last_ == 0 || !cmdvel_moving() )
+        return -1.0;
+
+    double age = (Metrics::Now() - cmdvel_last_) * 1e-9;
+    return std::max(0.0, cmdvel_timeout_ - age);
+}
+
+// Stop the robot once, when it is still being told to move but cmd_vel has
+// gone quiet for longer than cmd_vel_timeout
+void P2OSNode::check_cmdvel_timeout()
+{
+    if( cmdvel_timeout_ <= 0.0 || cmdvel_timed_out_ || cmdvel_last_ == 0 )
+        return;
+
+    double age = (Metrics::Now() - cmdvel_last_) * 1e-9;
+    if( age < cmdvel_timeout_ )
+        return;
+
+    // a robot already told to stand still has nothing to stop
+    if( !cmdvel_moving() )
+        return;
+
+    cmdvel_timed_out_ = true;
+    cmdvel_timeouts_++;
+    cmdvel_.linear.x = 0.0;
+    cmdvel_.linear.y = 0.0;
+    cmdvel_.angular.z = 0.0;
+
+    if( cmdvel_timeout_estop_ )
+    {
+        ROS_WARN( "No cmd_vel for %.3f s, emergency stop", age );
+        unsigned char command[1];
+        P2OSPacket packet;
+        command[0] = ESTOP;
+        packet.Build(command, 1);
+        SendReceive(&packet);
+        vel_dirty = false;
+        // whatever comes next has to be sent, starting from rest
+        cmd_filter_.Reset();
+        vel2_sent_ = false;
+        smoother_.Reset();
     }
     else
     {
-        ros::Duration veldur = ros::Time::now() - veltime;
-        if( veldur.toSec() > 5.0 && ((fabs(cmdvel_.linear.x) > 0.01) || (fabs(cmdvel_.angular.z) > 0.01)) )
-        {
-            ROS_DEBUG( "Maintaining old speed: %0.3f (%0.3f)", veltime.toSec(), ros::Time::now().toSec() );
-            vel_dirty = true;
-            veltime = ros::Time::now();
-        }
+        ROS_WARN( "No cmd_vel for %.3f s, stopping", age );
+        vel_dirty = true;
     }
 }
 
 void P2OSNode::check_and_set_vel()
 {
+    check_cmdvel_timeout();
+
     if( !vel_dirty )
         return;
-    vel_dirty = false;
 
-    ROS_DEBUG( "Setting vel: [%0.2f,%0.2f]", cmdvel_.linear.x, cmdvel_.angular.z);
+    ROS_DEBUG( "Setting vel: [%0.2f,%0.2f,%0.2f]", cmdvel_.linear.x, cmdvel_.linear.y, cmdvel_.angular.z);
 
-    unsigned short absSpeedDemand, absturnRateDemand;
-    unsigned char motorcommand[4];
-    P2OSPacket motorpacket;
+    // targets in the firmware's units, within the configured limits
+    double targets[CommandFilter::AXIS_COUNT];
+    targets[CommandFilter::AXIS_X] = LimitSpeed( cmdvel_.linear.x*1e3, motor_max_speed, "Linear" );
+    targets[CommandFilter::AXIS_Y] = LimitSpeed( cmdvel_.linear.y*1e3, motor_max_latspeed, "Lateral" );
+    targets[CommandFilter::AXIS_YAW] = LimitSpeed( RTOD(cmdvel_.angular.z), motor_max_turnspeed, "Rotational" );
 
-    int vx = (int)(cmdvel_.linear.x*1e3);
-    int va = (int)rint(RTOD(cmdvel_.angular.z));
+    double now = Metrics::Now() * 1e-9;
+    if( smooth_cmd_vel_ )
+    {
+        // from rest the first step is one loop period long
+        double dt = smoother_.Settled() ? 1.0 / frequency : now - smoother_last_;
+        smoother_.Update( dt, targets );
+        smoother_last_ = now;
+    }
 
-    // Linear velocity command
-    motorcommand[0] = VEL;
-    if( vx >= 0 )
-        motorcommand[1] = ARGINT;
-    else
-        motorcommand[1] = ARGNINT;
+    // only the axes whose command has really changed are sent
+    int values[CommandFilter::AXIS_COUNT];
+    unsigned int axes = cmd_filter_.Update( now, targets, values );
+    vel_dirty = cmd_filter_.Pending() || (smooth_cmd_vel_ && !smoother_.Settled());
 
-    absSpeedDemand = (unsigned short)abs(vx);
-    if( absSpeedDemand <= motor_max_speed )
+    if( direct_wheel_vel_control && !PlayerRobotParams[param_idx].Holonomic )
     {
-        motorcommand[2] = absSpeedDemand & 0x00FF;
-        motorcommand[3] = (absSpeedDemand & 0xFF00) >> 8;
+        // one VEL2 packet carries both wheels
+        if( axes & ((1 << CommandFilter::AXIS_X) | (1 << CommandFilter::AXIS_YAW)) )
+            SendWheelVelocities( values[CommandFilter::AXIS_X], values[CommandFilter::AXIS_YAW] );
+        return;
     }
-    else
+
+    if( axes & (1 << CommandFilter::AXIS_X) )
+        SendVelocity( VEL, values[CommandFilter::AXIS_X] );
+    if( axes & (1 << CommandFilter::AXIS_Y) )
+        SendVelocity( LATVEL, values[CommandFilter::AXIS_Y] );
+    if( axes & (1 << CommandFilter::AXIS_YAW) )
+        SendVelocity( RVEL, values[CommandFilter::AXIS_YAW] );
+}
+
+double P2OSNode::LimitSpeed( double demand, int max, const char *axis )
+{
+    if( fabs(demand) <= max )
+        return demand;
+
+    ROS_WARN("%s velocity command thresholded! (command: %.0f, max: %d)",
+             axis, demand, max);
+    return demand > 0 ? max : -max;
+}
+
+// Send a translational (mm/s) and rotational (deg/s) velocity as left and
+// right wheel speeds in a single VEL2 packet
+void P2OSNode::SendWheelVelocities( int vx, int va )
+{
+    double divisor = PlayerRobotParams[param_idx].Vel2Divisor;
+    if( divisor <= 0 )
+        divisor = 1;
+
+    double rot = DTOR(va) / PlayerRobotParams[param_idx].DiffConvFactor;
+    double right = vx + rot;
+    double left = vx - rot;
+
+    // each wheel is a signed byte of Vel2Divisor mm/s; scale both together
+    // when one is out of range so the curvature is kept
+    double limit = std::min( (double)motor_max_speed, 127.0 * divisor );
+    double biggest = std::max( fabs(right), fabs(left) );
+    if( biggest > limit )
     {
-        motorcommand[2] = motor_max_speed & 0x00FF;
-        motorcommand[3] = (motor_max_speed & 0xFF00) >> 8;
-        ROS_WARN("Linear velocity command thresholded! (command: %u, max: %u)",
-                 absSpeedDemand, motor_max_speed);
+        ROS_WARN("Wheel velocity command thresholded! (command: %.0f, max: %.0f)",
+                 biggest, limit);
+        right *= limit / biggest;
+        left *= limit / biggest;
     }
+
+    unsigned char motorcommand[4];
+    P2OSPacket motorpacket;
+    motorcommand[0] = VEL2;
+    motorcommand[1] = ARGINT;
+    motorcommand[2] = (unsigned char)(signed char)rint(right / divisor);
+    motorcommand[3] = (unsigned char)(signed char)rint(left / divisor);
+
+    // the command filter works in 1 mm/s and 1 deg/s, so most of its changes
+    // come out as the wheel speeds already sent
+    if( vel2_sent_ && motorcommand[2] == vel2_last_[0] && motorcommand[3] == vel2_last_[1] )
+    {
+        cmd_filter_.suppressed++;
+        return;
+    }
+    vel2_sent_ = true;
+    vel2_last_[0] = motorcommand[2];
+    vel2_last_[1] = motorcommand[3];
+
     motorpacket.Build(motorcommand, 4);
     SendReceive(&motorpacket);
+}
+
+// Send one of the signed velocity commands (VEL, RVEL, LATVEL)
+void P2OSNode::SendVelocity( unsigned char command, int value )
+{
+    unsigned short absDemand = (unsigned short)abs(value);
+    unsigned char motorcommand[4];
+    P2OSPacket motorpacket;
 
-    // Rotational velocity command
-    motorcommand[0] = RVEL;
-    if( va >= 0 )
+    motorcommand[0] = command;
+    if( value >= 0 )
         motorcommand[1] = ARGINT;
     else
         motorcommand[1] = ARGNINT;
-
-    absturnRateDemand = (unsigned short)abs(va);
-    if( absturnRateDemand <= motor_max_turnspeed )
-    {
-        motorcommand[2] = absturnRateDemand & 0x00FF;
-        motorcommand[3] = (absturnRateDemand & 0xFF00) >> 8;
-    }
-    else
-    {
-        motorcommand[2] = motor_max_turnspeed & 0x00FF;
-        motorcommand[3] = (motor_max_turnspeed & 0xFF00) >> 8;
-        ROS_WARN("Rotational velocity command threshholded! (command: %u, max: %u)",
-                 absturnRateDemand, motor_max_turnspeed);
-    }
+    motorcommand[2] = absDemand & 0x00FF;
+    motorcommand[3] = (absDemand & 0xFF00) >> 8;
 
     motorpacket.Build(motorcommand, 4);
     SendReceive(&motorpacket);
@@ -274,6 +592,7 @@ void P2OSNode::check_and_set_vel()
 
 void P2OSNode::gripperCallback(const p2os_driver::GripperStateConstPtr &msg)
 {
+    PiMutex::scoped_lock lock(state_mutex_);
     gripper_dirty_ = true;
     gripper_state_ = *msg;
 }
@@ -405,18 +724,91 @@ void P2OSNode::write_arm_state(ros::Time time, ros::Duration period)
     }
 }
 
-void P2OSNode::check_and_set_arm_state(ros::Time time, ros::Duration period, controller_manager::ControllerManager &cm)
+void P2OSNode::check_and_set_controllers(ros::Time time, ros::Duration period, controller_manager::ControllerManager &cm)
 {
+    if (!arm_initialized_ && !use_base_controller_)
+        return;
+
     if (arm_initialized_)
-    {
         read_arm_state();
-        cm.update(time,period);
+    if (use_base_controller_)
+        read_base_state();
+
+    cm.update(time,period);
+
+    if (arm_initialized_)
         write_arm_state(time,period);
+    if (use_base_controller_)
+        write_base_state();
+}
+
+void P2OSNode::base_initialize()
+{
+    std::string names[2];
+    ros::NodeHandle n_private("~");
+    n_private.param<std::string>( "left_wheel_joint", names[0], "left_wheel_joint");
+    n_private.param<std::string>( "right_wheel_joint", names[1], "right_wheel_joint");
+
+    for(int i = 0; i < 2; i++)
+    {
+        wheel_cmd_[i] = wheel_cmd_last_[i] = wheel_pos_[i] = wheel_vel_[i] = wheel_eff_[i] = 0.0;
+
+        hardware_interface::JointStateHandle state_handle(names[i], &wheel_pos_[i], &wheel_vel_[i], &wheel_eff_[i]);
+        jnt_state_interface.registerHandle(state_handle);
+        hardware_interface::JointHandle vel_handle(jnt_state_interface.getHandle(names[i]), &wheel_cmd_[i]);
+        jnt_vel_interface_.registerHandle(vel_handle);
+    }
+
+    registerInterface(&jnt_state_interface);
+    registerInterface(&jnt_vel_interface_);
+}
+
+// Wheel speeds (rad/s) from the last SIP, and wheel angles integrated from them
+void P2OSNode::read_base_state()
+{
+    if (!sippacket || wheel_radius_ <= 0.0)
+        return;
+
+    wheel_vel_[0] = sippacket->lvel / 1e3 / wheel_radius_;
+    wheel_vel_[1] = sippacket->rvel / 1e3 / wheel_radius_;
+
+    ros::Time stamp = sippacket->timeStandardSIP;
+    if (!wheel_stamp_.isZero() && stamp > wheel_stamp_)
+    {
+        double dt = (stamp - wheel_stamp_).toSec();
+        wheel_pos_[0] += wheel_vel_[0] * dt;
+        wheel_pos_[1] += wheel_vel_[1] * dt;
     }
+    wheel_stamp_ = stamp;
+}
+
+// Turn the controller's wheel speeds back into a body velocity command, so it
+// goes through the same limits, filtering and watchdog as cmd_vel. Only a
+// change in the controller's output counts as a new command for the watchdog.
+void P2OSNode::write_base_state()
+{
+    if (!sippacket)
+        return;
+    if (wheel_cmd_[0] == wheel_cmd_last_[0] && wheel_cmd_[1] == wheel_cmd_last_[1])
+        return;
+    wheel_cmd_last_[0] = wheel_cmd_[0];
+    wheel_cmd_last_[1] = wheel_cmd_[1];
+
+    double left = wheel_cmd_[0] * wheel_radius_ * 1e3;
+    double right = wheel_cmd_[1] * wheel_radius_ * 1e3;
+
+    cmdvel_.linear.x = (left + right) / 2.0 / 1e3;
+    cmdvel_.linear.y = 0.0;
+    cmdvel_.angular.z = (right - left) * PlayerRobotParams[param_idx].DiffConvFactor / 2.0;
+    vel_dirty = true;
+
+    cmdvel_last_ = Metrics::Now();
+    cmdvel_timed_out_ = false;
 }
 
 void P2OSNode::sonar_cb(const p2os_driver::SonarStateConstPtr &msg)
 {
+    PiMutex::scoped_lock lock(state_mutex_);
     if(use_sonar_ == msg->array_power) return;
 
     use_sonar_ = msg->array_power;
@@ -662,8 +1054,39 @@ int P2OSNode::Setup()
         param_idx = 0;
     }
 
+    ConfigureForRobot();
+
+    SendConfiguration();
+
+    ROS_INFO("Completed Serial Setup");
+    return(0);
+}
+
+// Sets up everything that depends on the robot type found at connect time,
+// for both the serial and the TCP connection
+void P2OSNode::ConfigureForRobot()
+{
     if(!sippacket)
         sippacket = new SIP(param_idx);
+    sippacket->printPeriod = sip_debug_period_;
+    sippacket->maxLateCycles = odom_max_late_cycles_;
+
+    // only holonomic robots take lateral velocity (LATVEL) commands
+    if(PlayerRobotParams[param_idx].Holonomic)
+        cmd_filter_.SetAxes((1 << CommandFilter::AXIS_X) | (1 << CommandFilter::AXIS_Y) |
+                            (1 << CommandFilter::AXIS_YAW));
+
+    SetupSonar();
+}
+
+// Writes the connect-time configuration from the parameters in one burst,
+// without waiting for a SIP after each command, then checks it against the
+// CONFIGpac the robot sends back
+void P2OSNode::SendConfiguration()
+{
+    PiMutex::scoped_lock lock(state_mutex_);
+    bool send_only = send_only_;
+    send_only_ = true;
 
     this->ToggleSonarPower(0);
 
@@ -798,7 +1221,6 @@ int P2OSNode::Setup()
         this->ToggleSonarPower(1);
         ROS_DEBUG("Sonar array powered on.");
     }
-    ptz_.setup();
     if(use_arm_)
     {
         // Request ArmInfo Packet to verify the arm exists/get arm properties
@@ -810,8 +1232,64 @@ int P2OSNode::Setup()
         ROS_DEBUG("Arm Interface enabled. Requesting ARMINFOPAC.");
     }
 
-    ROS_INFO("Completed Serial Setup");
-    return(0);
+    P2OSPacket config_packet;
+    unsigned char config_command[1];
+    config_command[0] = CONFIG;
+    config_packet.Build(config_command, 1);
+    sippacket->configReceived = false;
+    SendReceive(&config_packet, false);
+    send_only_ = send_only;
+
+    // The reply takes a SIP cycle or two; whatever else comes in meanwhile
+    // (SIPs, ARMINFOpac) is handled as usual
+    for(int i = 0; i < 20 && !sippacket->configReceived; i++)
+    {
+        uint64_t ready;
+        if(WaitForData(1.0, ready) < 0)
+            break;
+        SendReceive(NULL, false);
+    }
+    CheckConfiguration();
+
+    // the camera answers each step of its setup, so that stays a handshake
+    ptz_.setup();
+}
+
+// Warns about a setting the robot did not take; returns 1 if so
+static int check_config(const char *name, bool requested, int value, int actual)
+{
+    if(!requested || value == actual)
+        return(0);
+    ROS_WARN("The robot reports %s %d instead of the requested %d", name, actual, value);
+    return(1);
+}
+
+void P2OSNode::CheckConfiguration()
+{
+    if(!sippacket->configReceived)
+    {
+        ROS_WARN("No CONFIGpac from the robot; its configuration was not checked");
+        return;
+    }
+
+    const RobotConfig &config = sippacket->config;
+    int mismatches = 0;
+    mismatches += check_config("translational acceleration", motor_max_trans_accel > 0,
+                               motor_max_trans_accel, config.transAccel);
+    mismatches += check_config("translational deceleration", motor_max_trans_decel < 0,
+                               abs(motor_max_trans_decel), config.transDecel);
+    mismatches += check_config("rotational acceleration", motor_max_rot_accel > 0,
+                               motor_max_rot_accel, config.rotAccel);
+    mismatches += check_config("rotational deceleration", motor_max_rot_decel < 0,
+                               abs(motor_max_rot_decel), config.rotDecel);
+    mismatches += check_config("rot_kp", rot_kp >= 0, rot_kp, config.rotKP);
+    mismatches += check_config("rot_kv", rot_kv >= 0, rot_kv, config.rotKV);
+    mismatches += check_config("rot_ki", rot_ki >= 0, rot_ki, config.rotKI);
+    mismatches += check_config("trans_kp", trans_kp >= 0, trans_kp, config.transKP);
+    mismatches += check_config("trans_kv", trans_kv >= 0, trans_kv, config.transKV);
+    mismatches += check_config("trans_ki", trans_ki >= 0, trans_ki, config.transKI);
+    if(mismatches == 0)
+        ROS_DEBUG("Robot configuration verified against its CONFIGpac.");
 }
 
 void P2OSNode::setFileCloseOnExec(int fd, bool closeOnExec)
@@ -846,6 +1324,8 @@ int P2OSNode::Shutdown()
     unsigned char command[20], buffer[20];
     P2OSPacket packet;
 
+    // the control loop has stopped, so the camera's replies are read here
+    send_only_ = false;
     if (ptz_.isOn()) ptz_.shutdown();
 
     memset(buffer,0,20);
@@ -882,136 +1362,610 @@ int P2OSNode::Shutdown()
     return 0;
 }
 
-void P2OSNode::StandardSIPPutData(ros::Time ts)
+// Summaries of the raw SIP fields each slow-moving message is built from,
+// used to tell whether it has changed since it was last published
+unsigned int P2OSNode::BatteryValue()
+{
+    return sippacket->battery;
+}
+
+unsigned int P2OSNode::MotorValue()
+{
+    return sippacket->motors_enabled & 0x01;
+}
+
+unsigned int P2OSNode::GripperValue()
+{
+    // gripper and lift state bits, plus the break-beam and contact inputs
+    return (sippacket->timer & 0xFF) | (sippacket->digin << 8);
+}
+
+// Work out which outputs need to go out for this SIP, so that FillStandard()
+// can skip the rest
+unsigned int P2OSNode::OutputsDue(ros::Time ts)
+{
+    // pose and transform are cheap to fill and feed both pose and tf
+    unsigned int fields = FILL_ODOM;
+
+    if (batt_policy_.Due(ts, BatteryValue()))
+        fields |= FILL_BATTERY;
+    if (mstate_policy_.Due(ts, MotorValue()))
+        fields |= FILL_MOTORS;
+    if (grip_state_policy_.Due(ts, GripperValue()))
+        fields |= FILL_GRIPPER;
+    if (dio_policy_.Due(ts, sippacket->digin))
+        fields |= FILL_DIO;
+    if (aio_policy_.Due(ts, sippacket->analog))
+        fields |= FILL_AIO;
+    if (sonar_array_pub_.getNumSubscribers() > 0 ||
+        sonar_cloud_pub_.getNumSubscribers() > 0 ||
+        (publish_sonar_range_ && sonar_pub_.getNumSubscribers() > 0))
+        fields |= FILL_SONAR;
+
+    return fields;
+}
+
+void P2OSNode::StandardSIPPutData(ros::Time ts, unsigned int fields)
+{
+    uint32_t sonars;
+    unsigned int outputs = TakeOutputs(ts, fields, sonars);
+    PutOutputs(p2os_data, ptz_.getCurrentState(), sonars, ts, outputs);
+}
+
+// Settles which of the fields filled for the SIP at ts go out, along with
+// the pose, tf and PTZ state (PUT_*), and marks them published.  sonars is
+// set to the transducers read since the last publish.  Needs the state lock.
+unsigned int P2OSNode::TakeOutputs(ros::Time ts, unsigned int fields, uint32_t &sonars)
+{
+    unsigned int outputs = fields & (FILL_BATTERY | FILL_MOTORS | FILL_SONAR |
+                                     FILL_GRIPPER | FILL_DIO | FILL_AIO);
+
+    if (pose_policy_.Due(ts))
+    {
+        outputs |= PUT_POSE;
+        pose_policy_.Published(ts);
+    }
+    if (publish_tf_ && tf_policy_.Due(ts))
+    {
+        outputs |= PUT_TF;
+        tf_policy_.Published(ts);
+    }
+    if (ptz_state_policy_.Due(ts))
+    {
+        outputs |= PUT_PTZ;
+        ptz_state_policy_.Published(ts);
+    }
+
+    if (fields & FILL_BATTERY)
+        batt_policy_.Published(ts, BatteryValue());
+    if (fields & FILL_MOTORS)
+        mstate_policy_.Published(ts, MotorValue());
+    if (fields & FILL_AIO)
+        aio_policy_.Published(ts, sippacket->analog);
+    if (fields & FILL_DIO)
+        dio_policy_.Published(ts, sippacket->digin);
+    if (fields & FILL_GRIPPER)
+        grip_state_policy_.Published(ts, GripperValue());
+
+    // the sonar readings go out now, or nobody wanted them
+    sonars = sippacket->sonarsUpdated;
+    sippacket->sonarsUpdated = 0;
+
+    return outputs;
+}
+
+// Publishes what TakeOutputs() settled from data and ptz.  It uses nothing
+// the control loop changes, so it can run without the state lock.
+void P2OSNode::PutOutputs(ros_p2os_data_t &data, const p2os_driver::PTZState &ptz,
+                          uint32_t sonars, ros::Time ts, unsigned int outputs)
 {
     // put position data
-    p2os_data.position.header.stamp    = ts;
-    p2os_data.position.header.frame_id = "/odom";
-    p2os_data.position.child_frame_id  = "/base_link";
+    data.position.header.stamp    = ts;
 
-    pose_pub_.publish( p2os_data.position );
-    p2os_data.odom_trans.header.stamp = ts;
-    odom_broadcaster.sendTransform( p2os_data.odom_trans );
+    if (outputs & PUT_POSE)
+        pose_pub_.publish( data.position );
+    if (outputs & PUT_TF)
+    {
+        data.odom_trans.header.stamp = ts;
+        odom_broadcaster.sendTransform( data.odom_trans );
+    }
 
     // put battery data
-    p2os_data.batt.header.stamp = ts;
-    batt_pub_.publish( p2os_data.batt );
+    if (outputs & FILL_BATTERY)
+    {
+        data.batt.header.stamp = ts;
+        batt_pub_.publish( data.batt );
+    }
+    else
+    {
+        // keep the frequency diagnostic tracking the SIP rate
+        batt_pub_.tick(ts);
+    }
 
     // put motor data
-    mstate_pub_.publish( p2os_data.motors );
+    if (outputs & FILL_MOTORS)
+        mstate_pub_.publish( data.motors );
 
     // put sonar data
-    if (sonar_pub_.getNumSubscribers() > 0)
+    if (outputs & FILL_SONAR)
     {
-        sensor_msgs::Range sonar;
-        sonar.header.stamp = ros::Time::now();
-        sonar.radiation_type = sensor_msgs::Range::ULTRASOUND;
-        sonar.field_of_view = ((15.0)/180.0) * 3.14;
-        sonar.min_range = 0.0;
-        sonar.max_range = 10.0;
+        if (sonars && sonar_array_pub_.getNumSubscribers() > 0)
+        {
+            data.sonar.header.stamp = ts;
+            sonar_array_pub_.publish( data.sonar );
+        }
+
+        UpdateSonarCloud(data.sonar, sonars);
+        if (sonar_cloud_.width > 0 && sonar_cloud_pub_.getNumSubscribers() > 0)
+        {
+            sonar_cloud_.header.stamp = ts;
+            sonar_cloud_pub_.publish( sonar_cloud_ );
+        }
 
-        for(int i=1; i<=p2os_data.sonar.ranges_count; i++)
+        if (publish_sonar_range_ && sonar_pub_.getNumSubscribers() > 0)
         {
-            sonar.range = p2os_data.sonar.ranges[i-1];
+            // only transducers beyond the robot's SonarNum still need a name
+            while ((int)sonar_frame_ids_.size() < data.sonar.ranges_count)
+                sonar_frame_ids_.push_back(SonarFrameId(sonar_frame_ids_.size()));
 
-            char frame_id[64];
-            sprintf(frame_id, "/Sonar_%d", i);
-            sonar.header.frame_id = frame_id;
-            sonar_pub_.publish(sonar);
+            // only the transducers fired since the last publish
+            for(int i=0; i<data.sonar.ranges_count && i<32; i++)
+            {
+                if (!(sonars & (1u << i)))
+                    continue;
+                sonar_range_.header.stamp = data.sonar.stamps[i];
+                sonar_range_.range = data.sonar.ranges[i];
+                sonar_range_.header.frame_id = sonar_frame_ids_[i];
+                sonar_pub_.publish(sonar_range_);
+            }
         }
     }
 
-    //p2os_data.sonar.header.stamp = ts;
-    //sonar_pub_.publish( p2os_data.sonar );
-
     // put aio data
-    aio_pub_.publish( p2os_data.aio);
+    if (outputs & FILL_AIO)
+        aio_pub_.publish( data.aio);
 
     // put dio data
-    dio_pub_.publish( p2os_data.dio);
+    if (outputs & FILL_DIO)
+        dio_pub_.publish( data.dio);
 
     // put gripper and lift data
-    grip_state_pub_.publish( p2os_data.gripper );
-    ptz_state_pub_.publish( ptz_.getCurrentState() );
+    if (outputs & FILL_GRIPPER)
+        grip_state_pub_.publish( data.gripper );
+    if (outputs & PUT_PTZ)
+        ptz_state_pub_.publish( ptz );
 
     // put bumper data
     // put compass data
 }
 
+// Size the sonar outputs for this robot, lay out the sonar cloud (up to one
+// point per transducer, in the base frame), name each transducer's frame and
+// cache where it sits and which way it faces.
+void P2OSNode::SetupSonar()
+{
+    int num = PlayerRobotParams[param_idx].SonarNum;
+
+    p2os_data.sonar.ranges.reserve(num);
+    p2os_data.sonar.stamps.reserve(num);
+    p2os_data.sonar.seqs.reserve(num);
+
+    sonar_frame_ids_.clear();
+    for (int i = 0; i < num; i++)
+        sonar_frame_ids_.push_back(SonarFrameId(i));
+
+    if (num > 32)
+        num = 32;
+
+    sonar_x_.resize(num);
+    sonar_y_.resize(num);
+    sonar_cos_.resize(num);
+    sonar_sin_.resize(num);
+    for (int i = 0; i < num; i++)
+    {
+        const sonar_pose_t &pose = PlayerRobotParams[param_idx].sonar_pose[i];
+        double th = DTOR(pose.th);
+        sonar_x_[i] = pose.x / 1e3;
+        sonar_y_[i] = pose.y / 1e3;
+        sonar_cos_[i] = cos(th);
+        sonar_sin_[i] = sin(th);
+    }
+
+    sonar_cloud_.header.frame_id = base_frame_id_;
+    sonar_cloud_.height = 1;
+    sonar_cloud_.width = 0;
+    sonar_cloud_.fields.resize(3);
+    const char *names[3] = { "x", "y", "z" };
+    for (int i = 0; i < 3; i++)
+    {
+        sonar_cloud_.fields[i].name = names[i];
+        sonar_cloud_.fields[i].offset = i * sizeof(float);
+        sonar_cloud_.fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+        sonar_cloud_.fields[i].count = 1;
+    }
+    sonar_cloud_.is_bigendian = false;
+    sonar_cloud_.point_step = 3 * sizeof(float);
+    sonar_cloud_.is_dense = true;
+    sonar_cloud_.data.reserve(sonar_cloud_.point_step * num);
+}
+
+// Fully resolved frame id of transducer index (0-based)
+std::string P2OSNode::SonarFrameId(int index)
+{
+    char frame_id[64];
+    snprintf(frame_id, sizeof(frame_id), "%s%d", sonar_frame_prefix_.c_str(), index + 1);
+    return tf::resolve(tf_prefix_, frame_id);
+}
+
+// Project the transducers fired since the last publish into the sonar cloud.
+// Older readings are left out so they aren't mistaken for new echoes.
+void P2OSNode::UpdateSonarCloud(const p2os_driver::SonarArray &sonar, uint32_t updated)
+{
+    int num = std::min((int)sonar_x_.size(), sonar.ranges_count);
+    int n = 0;
+
+    sonar_cloud_.data.resize(sonar_cloud_.point_step * num);
+    for (int i = 0; i < num; i++)
+    {
+        double range = sonar.ranges[i];
+        if (!(updated & (1u << i)) || range >= sonar_max_range_)
+            continue;
+
+        float point[3];
+        point[0] = sonar_x_[i] + range * sonar_cos_[i];
+        point[1] = sonar_y_[i] + range * sonar_sin_[i];
+        point[2] = 0.0;
+        memcpy(&sonar_cloud_.data[n * sonar_cloud_.point_step], point, sizeof(point));
+        n++;
+    }
+
+    sonar_cloud_.width = n;
+    sonar_cloud_.row_step = sonar_cloud_.point_step * n;
+    sonar_cloud_.data.resize(sonar_cloud_.row_step);
+}
+
+// Upper edges (ms) of the SIP interval histogram bins; the last bin is open
+static const double link_interval_edges[LINK_INTERVAL_BINS - 1] =
+    { 25, 50, 75, 100, 125, 150, 200, 300 };
+
+static bool is_standard_sip(const P2OSPacket &packet)
+{
+    return packet.packet[0] == 0xFA && packet.packet[1] == 0xFB &&
+           (packet.packet[3] == 0x30 || packet.packet[3] == 0x31 ||
+            packet.packet[3] == 0x32 || packet.packet[3] == 0x33 ||
+            packet.packet[3] == 0x34);
+}
+
 /* send the packet, then receive and parse an SIP */
 int P2OSNode::SendReceive(P2OSPacket* pkt, bool publish_data)
 {
+    PiMutex::scoped_lock lock(state_mutex_);
     P2OSPacket packet;
 
     if((psos_fd >= 0) && sippacket)
     {
-        if(pkt) pkt->Send(psos_fd);
-
-        /* receive a packet */
-        pthread_testcancel();
-        if(packet.Receive(psos_fd))
+        if(pkt)
         {
-            ROS_ERROR("P2OSNode::SendReceive() - Receive error");
-            pthread_exit(NULL);
+            pkt->Send(psos_fd);
+            metrics_.Add(Metrics::COMMANDS_SENT);
+            // any command resets the robot's watchdog
+            lastPulseTime = Metrics::Now() * 1e-9;
+
+            // the loop reads whatever comes back in ReceiveSIP()
+            if(send_only_)
+                return(0);
         }
 
-        if(packet.packet[0] == 0xFA && packet.packet[1] == 0xFB &&
-                (packet.packet[3] == 0x30 || packet.packet[3] == 0x31 ||
-                 packet.packet[3] == 0x32 || packet.packet[3] == 0x33 ||
-                 packet.packet[3] == 0x34))
-        {
+        ReadPacket(packet);
+        CountPacket(packet);
 
+        if(is_standard_sip(packet))
+        {
             /* It is a server packet, so process it */
-            sippacket->ParseStandard(&packet.packet[3]);
-            sippacket->FillStandard(&p2os_data);
-
-            if(publish_data) StandardSIPPutData(packet.timestamp);
+            ParseSIP(packet);
+            UseSIP(packet.timestamp, publish_data);
         }
-        else if(packet.packet[0] == 0xFA &&
-                packet.packet[1] == 0xFB &&
-                packet.packet[3] == SERAUX)
+        else
         {
-            // This is an AUX serial packet
-            if(ptz_.isOn())
-            {
-                int len = packet.packet[2] - 3;
-                if (ptz_.cb_.gotPacket())
-                {
-                    ROS_ERROR("PTZ got a message, but already have the complete packet.");
-                }
-                else
-                {
-                    for (int i=4; i < 4+len; ++i)
-                        ptz_.cb_.putOnBuf(packet.packet[i]);
-                }
-            }
+            HandlePacket(packet, publish_data);
         }
-        else if(packet.packet[0] == 0xFA && packet.packet[1] == 0xFB && packet.packet[3] == ARMPAC)
-        {
-            this->sippacket->ParseArm(&packet.packet[2]);
+    }
 
-            if(publish_data)
-            {
-                read_arm_state();
-            }
-        }
-        else if(packet.packet[0] == 0xFA && packet.packet[1] == 0xFB && packet.packet[3] == ARMINFOPAC)
+    return(0);
+}
+
+// Waits up to timeout seconds for the robot to send something, without
+// holding the state lock.  Returns 1 if data was already waiting, 0 if it
+// arrived while waiting and -1 if nothing came; ready is set to the
+// monotonic time (ns) the data was seen.
+int P2OSNode::WaitForData(double timeout, uint64_t &ready)
+{
+    struct pollfd pfd;
+    pfd.fd = psos_fd;
+    pfd.events = POLLIN;
+
+    ready = Metrics::Now();
+    if(psos_fd < 0)
+        return(-1);
+    if(poll(&pfd, 1, 0) > 0)
+        return(1);
+    if(poll(&pfd, 1, (int)(timeout * 1e3)) <= 0)
+        return(-1);
+    ready = Metrics::Now();
+    return(0);
+}
+
+// Reads everything the robot has sent since the last cycle, waiting for a
+// SIP if none has queued.  Every packet is handled and every standard SIP
+// parsed, since the odometry and sonar are built up from successive SIPs,
+// but only the newest SIP is filled in and published, with the sonar
+// readings of all of them (see SIP::sonarsUpdated).  ready is when the
+// data was seen (see WaitForData()) and late says it was already queued,
+// for the link diagnostics.
+//
+// Only the control loop reads the link once commands are send-only (see
+// SetSendOnly()), so the packets are read without the state lock and the
+// callbacks are not held up while they come in over the serial line.
+int P2OSNode::ReceiveSIP(uint64_t ready, bool late)
+{
+    struct pollfd pfd;
+    uint64_t arrived = 0;
+    int count = 0;
+    int sips = 0;
+
+    if((psos_fd < 0) || !sippacket)
+        return(-1);
+
+    pfd.fd = psos_fd;
+    pfd.events = POLLIN;
+    while(ros::ok() && count < RX_QUEUE_LEN && (sips == 0 || poll(&pfd, 1, 0) > 0))
+    {
+        ReadPacket(rx_queue_[count]);
+        if(is_standard_sip(rx_queue_[count]))
+            sips++;
+        count++;
+    }
+
+    PiMutex::scoped_lock lock(state_mutex_);
+    ros::Time stamp;
+    for(int i = 0; i < count; i++)
+    {
+        P2OSPacket &packet = rx_queue_[i];
+        CountPacket(packet);
+        if(is_standard_sip(packet))
         {
-            this->sippacket->ParseArmInfo(&packet.packet[2]);
-            arm_initialize();
+            ParseSIP(packet);
+            stamp = packet.timestamp;
+            arrived = packet.headerTime;
         }
         else
         {
-            ROS_ERROR("Received unexpected packet.");
-            packet.PrintHex();
+            HandlePacket(packet, true);
         }
     }
+    if(sips == 0)
+        return(-1);
 
+    UseSIP(stamp, true);
+    if(sips > 1)
+    {
+        link_.coalesced += sips - 1;
+        metrics_.Add(Metrics::COALESCED_SIPS, sips - 1);
+    }
+
+    // a SIP that was not queued yet may have come after ready
+    if(!late)
+        ready = std::max(ready, arrived);
+    double latency = (Metrics::Now() - ready) * 1e-9;
+    link_.latencies++;
+    link_.latency_sum += latency;
+    link_.latency_max = std::max(link_.latency_max, latency);
+    if(late)
+        link_.late_cycles++;
     return(0);
 }
 
+// Gets more of the camera's reply into the PTZ's buffer.  Once commands are
+// send-only the control loop reads the link and hands the AUX packets over
+// (see HandlePacket()), so this only waits for them, letting go of the state
+// lock meanwhile; otherwise it reads the next packet itself.
+void P2OSNode::ReceiveAux(PiMutex::scoped_lock &lock, double timeout)
+{
+    if(!send_only_)
+    {
+        SendReceive(NULL, false);
+        return;
+    }
+    aux_cond_.timed_wait(lock, boost::posix_time::microseconds((long)(timeout * 1e6)));
+}
+
+void P2OSNode::ReadPacket(P2OSPacket &packet)
+{
+    /* receive a packet */
+    pthread_testcancel();
+    uint64_t t_read = Metrics::Now();
+    if(packet.Receive(psos_fd))
+    {
+        ROS_ERROR("P2OSNode::SendReceive() - Receive error");
+        pthread_exit(NULL);
+    }
+    metrics_.Record(Metrics::STAGE_READ, t_read, packet.headerTime);
+    metrics_.Record(Metrics::STAGE_FRAME, packet.headerTime, Metrics::Now());
+    metrics_.Add(Metrics::PACKETS);
+    metrics_.Add(Metrics::CHECKSUM_FAILURES, packet.badChecksums);
+    metrics_.Add(Metrics::BYTES_SKIPPED, packet.skipped);
+}
+
+// Adds what it took to read a packet to the link diagnostics
+void P2OSNode::CountPacket(const P2OSPacket &packet)
+{
+    link_.checksum_failures += packet.badChecksums;
+    link_.bytes_skipped += packet.skipped;
+    if(packet.skipped > 0)
+        link_.resyncs++;
+}
+
+// Brings the SIP state up to date from a standard SIP
+void P2OSNode::ParseSIP(P2OSPacket &packet)
+{
+    uint64_t t_parse = Metrics::Now();
+
+    link_.sips++;
+    if(!link_last_sip_.isZero())
+    {
+        double interval = (packet.timestamp - link_last_sip_).toSec();
+        int bin = 0;
+        while(bin < LINK_INTERVAL_BINS - 1 && interval * 1e3 >= link_interval_edges[bin])
+            bin++;
+        link_.intervals++;
+        link_.interval_sum += interval;
+        link_.interval_sum_sq += interval * interval;
+        link_.interval_hist[bin]++;
+    }
+    link_last_sip_ = packet.timestamp;
+    metrics_.Add(Metrics::SIPS);
+
+    sippacket->ParseStandard(&packet.packet[3], packet.timestamp);
+    metrics_.Record(Metrics::STAGE_PARSE, t_parse, Metrics::Now());
+}
+
+// Fills p2os_data from the last parsed SIP and publishes what is due
+void P2OSNode::UseSIP(ros::Time ts, bool publish_data)
+{
+    uint64_t t_fill = Metrics::Now();
+
+    unsigned int fields = publish_data ? OutputsDue(ts) : (unsigned int)FILL_ALL;
+    sippacket->FillStandard(&p2os_data, fields);
+    // the robot's time since the last estimate, whatever the read times say
+    unsigned int cycles = sippacket->sipCount - estimator_sips_;
+    estimator_sips_ = sippacket->sipCount;
+    velocity_estimator_.Update(ts, cycles * sippacket->sipCycle, p2os_data.position);
+    if (sippacket->motors_enabled & 0x01)
+        extrapolator_.Update(ts, p2os_data.position,
+                             cmdvel_.linear.x, cmdvel_.angular.z);
+    else
+        extrapolator_.Update(ts, p2os_data.position, 0.0, 0.0);
+    uint64_t t_filled = Metrics::Now();
+    metrics_.Record(Metrics::STAGE_FILL, t_fill, t_filled);
+
+    if(publish_data && defer_publish_)
+    {
+        // outputs still due from a SIP not yet published go out as well
+        publish_ts_ = ts;
+        publish_fields_ |= fields;
+        publish_pending_ = true;
+        publish_cond_.notify_one();
+    }
+    else if(publish_data)
+    {
+        StandardSIPPutData(ts, fields);
+        metrics_.Record(Metrics::STAGE_PUBLISH, t_filled, Metrics::Now());
+    }
+}
+
+// Publishes the SIP the control loop last filled in, waiting up to timeout
+// seconds for one
+void P2OSNode::PublishPending(double timeout)
+{
+    PiMutex::scoped_lock lock(state_mutex_);
+    if(!publish_pending_)
+        publish_cond_.timed_wait(lock, boost::posix_time::microseconds((long)(timeout * 1e6)));
+    if(!publish_pending_)
+        return;
+
+    unsigned int fields = publish_fields_;
+    publish_pending_ = false;
+    publish_fields_ = 0;
+
+    // only the copying is done under the lock; roscpp gets the copies
+    uint64_t t_publish = Metrics::Now();
+    uint32_t sonars;
+    ros::Time ts = publish_ts_;
+    unsigned int outputs = TakeOutputs(ts, fields, sonars);
+    publish_data_ = p2os_data;
+    publish_ptz_ = ptz_.getCurrentState();
+    lock.unlock();
+
+    PutOutputs(publish_data_, publish_ptz_, sonars, ts, outputs);
+    metrics_.Record(Metrics::STAGE_PUBLISH, t_publish, Metrics::Now());
+}
+
+// Everything that is not a standard SIP
+void P2OSNode::HandlePacket(P2OSPacket &packet, bool publish_data)
+{
+    if(packet.packet[0] == 0xFA &&
+            packet.packet[1] == 0xFB &&
+            packet.packet[3] == SERAUX)
+    {
+        // This is an AUX serial packet
+        if(ptz_.isOn())
+        {
+            int len = packet.packet[2] - 3;
+            if (ptz_.cb_.gotPacket())
+            {
+                ROS_ERROR("PTZ got a message, but already have the complete packet.");
+            }
+            else
+            {
+                for (int i=4; i < 4+len; ++i)
+                    ptz_.cb_.putOnBuf(packet.packet[i]);
+                aux_cond_.notify_all();
+            }
+        }
+    }
+    else if(packet.packet[0] == 0xFA && packet.packet[1] == 0xFB && packet.packet[3] == ARMPAC)
+    {
+        this->sippacket->ParseArm(&packet.packet[2]);
+
+        if(publish_data)
+        {
+            read_arm_state();
+        }
+    }
+    else if(packet.packet[0] == 0xFA && packet.packet[1] == 0xFB && packet.packet[3] == ARMINFOPAC)
+    {
+        this->sippacket->ParseArmInfo(&packet.packet[2]);
+        arm_initialize();
+    }
+    else if(packet.packet[0] == 0xFA && packet.packet[1] == 0xFB && packet.packet[3] == CONFIGPAC)
+    {
+        this->sippacket->ParseConfig(&packet.packet[2]);
+    }
+    else
+    {
+        link_.unexpected++;
+        metrics_.Add(Metrics::UNEXPECTED_PACKETS);
+        ROS_ERROR("Received unexpected packet.");
+        packet.PrintHex();
+    }
+}
+
+void P2OSNode::ptz_cb(const p2os_driver::PTZStateConstPtr &msg)
+{
+    // the camera talks through the robot link.  Once the control loop reads
+    // it, the exchange only takes the state lock to send and to wait for
+    // each reply (see ReceiveAux()), so the loop keeps running meanwhile;
+    // otherwise this has to wait its turn.
+    if(send_only_)
+    {
+        ptz_.callback(msg);
+        return;
+    }
+    PiMutex::scoped_lock lock(state_mutex_);
+    ptz_.callback(msg);
+}
+
+void P2OSNode::CycleStarted()
+{
+    uint64_t now = Metrics::Now();
+    if(cycle_start_)
+        metrics_.Record(Metrics::STAGE_CYCLE, cycle_start_, now);
+    cycle_start_ = now;
+}
+
 void P2OSNode::updateDiagnostics()
 {
+    PiMutex::scoped_lock lock(state_mutex_);
     diagnostic_.update();
 }
 
@@ -1040,6 +1994,100 @@ void P2OSNode::check_stall(diagnostic_updater::DiagnosticStatusWrapper &stat)
     stat.add("Right wheel stall", sippacket->rwstall);
 }
 
+void P2OSNode::check_odometry(diagnostic_updater::DiagnosticStatusWrapper &stat)
+{
+    unsigned int rejected = sippacket->odomRejected - last_odom_rejected_;
+    last_odom_rejected_ = sippacket->odomRejected;
+
+    if(rejected > 0)
+        stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "Odometry updates rejected.");
+    else
+        stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Odometry OK.");
+
+    stat.add("Rejected updates", sippacket->odomRejected);
+    stat.add("Recovered wraps", sippacket->odomRecovered);
+}
+
+void P2OSNode::check_link(diagnostic_updater::DiagnosticStatusWrapper &stat)
+{
+    ros::Time now = ros::Time::now();
+    double elapsed = (now - link_reported_time_).toSec();
+    unsigned int sips = link_.sips - link_reported_.sips;
+    unsigned int failures = link_.checksum_failures - link_reported_.checksum_failures;
+    unsigned int resyncs = link_.resyncs - link_reported_.resyncs;
+    unsigned int unexpected = link_.unexpected - link_reported_.unexpected;
+    unsigned int intervals = link_.intervals - link_reported_.intervals;
+    double sum = link_.interval_sum - link_reported_.interval_sum;
+    double sum_sq = link_.interval_sum_sq - link_reported_.interval_sum_sq;
+
+    double mean = 0.0, jitter = 0.0;
+    if(intervals > 0)
+    {
+        mean = sum / intervals;
+        jitter = sqrt(std::max(sum_sq / intervals - mean * mean, 0.0));
+    }
+    unsigned int latencies = link_.latencies - link_reported_.latencies;
+    double latency = 0.0;
+    if(latencies > 0)
+        latency = (link_.latency_sum - link_reported_.latency_sum) / latencies;
+
+    if(sips == 0)
+        stat.summary(diagnostic_msgs::DiagnosticStatus::ERROR, "No SIPs received.");
+    else if(failures > 0 || resyncs > 0 || unexpected > 0)
+        stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "Corrupt or unexpected data on the link.");
+    else
+        stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Link OK.");
+
+    stat.add("SIP rate (Hz)", elapsed > 0.0 ? sips / elapsed : 0.0);
+    stat.add("SIP interval mean (ms)", mean * 1e3);
+    stat.add("SIP interval jitter (ms)", jitter * 1e3);
+    stat.add("SIPs", link_.sips);
+    stat.add("Checksum failures", link_.checksum_failures);
+    stat.add("Bytes skipped", link_.bytes_skipped);
+    stat.add("Resyncs", link_.resyncs);
+    stat.add("Unexpected packets", link_.unexpected);
+    stat.add("Pending commands", (int)vel_dirty + (int)motor_dirty + (int)gripper_dirty_);
+    stat.add("Velocity commands sent", cmd_filter_.sent);
+    stat.add("Velocity commands suppressed", cmd_filter_.suppressed);
+    if(sip_locked_ || drain_sips_)
+    {
+        stat.add("SIP latency mean (ms)", latency * 1e3);
+        stat.add("SIP latency max (ms)", link_.latency_max * 1e3);
+        stat.add("Late cycles", link_.late_cycles);
+        stat.add("Coalesced SIPs", link_.coalesced);
+    }
+    for(int i = 0; i < LINK_INTERVAL_BINS; i++)
+    {
+        char label[64];
+        if(i < LINK_INTERVAL_BINS - 1)
+            snprintf(label, sizeof(label), "SIP interval < %.0f ms", link_interval_edges[i]);
+        else
+            snprintf(label, sizeof(label), "SIP interval >= %.0f ms", link_interval_edges[i - 1]);
+        stat.add(label, link_.interval_hist[i]);
+    }
+
+    link_.latency_max = 0.0;
+    link_reported_ = link_;
+    link_reported_time_ = now;
+}
+
+void P2OSNode::check_cmdvel_watchdog(diagnostic_updater::DiagnosticStatusWrapper &stat)
+{
+    double age = cmdvel_last_ ? (Metrics::Now() - cmdvel_last_) * 1e-9 : -1.0;
+
+    if(cmdvel_timeout_ <= 0.0)
+        stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Watchdog disabled.");
+    else if(cmdvel_timed_out_)
+        stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "cmd_vel timed out, robot stopped.");
+    else
+        stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "cmd_vel OK.");
+
+    stat.add("Timeout (s)", cmdvel_timeout_);
+    stat.add("Action", cmdvel_timeout_estop_ ? "estop" : "stop");
+    stat.add("Last cmd_vel age (s)", age);
+    stat.add("Timeouts", cmdvel_timeouts_);
+}
+
 void P2OSNode::ResetRawPositions()
 {
     P2OSPacket pkt;
@@ -1051,6 +2099,7 @@ void P2OSNode::ResetRawPositions()
         this->sippacket->rawypos = 0;
         this->sippacket->xpos = 0;
         this->sippacket->ypos = 0;
+        velocity_estimator_.Reset();
         p2oscommand[0] = SETO;
         p2oscommand[1] = ARGINT;
         pkt.Build(p2oscommand, 2);
@@ -1176,6 +2225,13 @@ void P2OSNode::SendPulse(void)
     SendReceive(&packet);
 }
 
+// Keep the robot's watchdog fed when nothing else has been sent for a while
+void P2OSNode::check_and_send_pulse()
+{
+    if( Metrics::Now() * 1e-9 - lastPulseTime >= pulse_period )
+        SendPulse();
+}
+
 int P2OSNode::SetupTCP()
 {
     int i;
@@ -1381,148 +2437,14 @@ int P2OSNode::SetupTCP()
         param_idx = 0;
     }
 
-    if(!sippacket)
-        sippacket = new SIP(param_idx);
+    ConfigureForRobot();
 
-    this->ToggleSonarPower(0);
-
-    // if requested, set max accel/decel limits
-    P2OSPacket accel_packet;
-    unsigned char accel_command[4];
-    if(this->motor_max_trans_accel > 0)
-    {
-        accel_command[0] = SETA;
-        accel_command[1] = ARGINT;
-        accel_command[2] = this->motor_max_trans_accel & 0x00FF;
-        accel_command[3] = (this->motor_max_trans_accel & 0xFF00) >> 8;
-        accel_packet.Build(accel_command, 4);
-        this->SendReceive(&accel_packet,false);
-    }
-
-    if(this->motor_max_trans_decel < 0)
-    {
-        accel_command[0] = SETA;
-        accel_command[1] = ARGNINT;
-        accel_command[2] = abs(this->motor_max_trans_decel) & 0x00FF;
-        accel_command[3] = (abs(this->motor_max_trans_decel) & 0xFF00) >> 8;
-        accel_packet.Build(accel_command, 4);
-        this->SendReceive(&accel_packet,false);
-    }
-    if(this->motor_max_rot_accel > 0)
-    {
-        accel_command[0] = SETRA;
-        accel_command[1] = ARGINT;
-        accel_command[2] = this->motor_max_rot_accel & 0x00FF;
-        accel_command[3] = (this->motor_max_rot_accel & 0xFF00) >> 8;
-        accel_packet.Build(accel_command, 4);
-        this->SendReceive(&accel_packet,false);
-    }
-    if(this->motor_max_rot_decel < 0)
-    {
-        accel_command[0] = SETRA;
-        accel_command[1] = ARGNINT;
-        accel_command[2] = abs(this->motor_max_rot_decel) & 0x00FF;
-        accel_command[3] = (abs(this->motor_max_rot_decel) & 0xFF00) >> 8;
-        accel_packet.Build(accel_command, 4);
-        this->SendReceive(&accel_packet,false);
-    }
-
-
-    // if requested, change PID settings
-    P2OSPacket pid_packet;
-    unsigned char pid_command[4];
-    if(this->rot_kp >= 0)
-    {
-        pid_command[0] = ROTKP;
-        pid_command[1] = ARGINT;
-        pid_command[2] = this->rot_kp & 0x00FF;
-        pid_command[3] = (this->rot_kp & 0xFF00) >> 8;
-        pid_packet.Build(pid_command, 4);
-        this->SendReceive(&pid_packet);
-    }
-    if(this->rot_kv >= 0)
-    {
-        pid_command[0] = ROTKV;
-        pid_command[1] = ARGINT;
-        pid_command[2] = this->rot_kv & 0x00FF;
-        pid_command[3] = (this->rot_kv & 0xFF00) >> 8;
-        pid_packet.Build(pid_command, 4);
-        this->SendReceive(&pid_packet);
-    }
-    if(this->rot_ki >= 0)
-    {
-        pid_command[0] = ROTKI;
-        pid_command[1] = ARGINT;
-        pid_command[2] = this->rot_ki & 0x00FF;
-        pid_command[3] = (this->rot_ki & 0xFF00) >> 8;
-        pid_packet.Build(pid_command, 4);
-        this->SendReceive(&pid_packet);
-    }
-    if(this->trans_kp >= 0)
-    {
-        pid_command[0] = TRANSKP;
-        pid_command[1] = ARGINT;
-        pid_command[2] = this->trans_kp & 0x00FF;
-        pid_command[3] = (this->trans_kp & 0xFF00) >> 8;
-        pid_packet.Build(pid_command, 4);
-        this->SendReceive(&pid_packet);
-    }
-    if(this->trans_kv >= 0)
-    {
-        pid_command[0] = TRANSKV;
-        pid_command[1] = ARGINT;
-        pid_command[2] = this->trans_kv & 0x00FF;
-        pid_command[3] = (this->trans_kv & 0xFF00) >> 8;
-        pid_packet.Build(pid_command, 4);
-        this->SendReceive(&pid_packet);
-    }
-    if(this->trans_ki >= 0)
-    {
-        pid_command[0] = TRANSKI;
-        pid_command[1] = ARGINT;
-        pid_command[2] = this->trans_ki & 0x00FF;
-        pid_command[3] = (this->trans_ki & 0xFF00) >> 8;
-        pid_packet.Build(pid_command, 4);
-        this->SendReceive(&pid_packet);
-    }
-
-
-    // if requested, change bumper-stall behavior
-    // 0 = don't stall
-    // 1 = stall on front bumper contact
-    // 2 = stall on rear bumper contact
-    // 3 = stall on either bumper contact
-    if(this->bumpstall >= 0)
-    {
-        if(this->bumpstall > 3)
-        {
-            ROS_WARN("Ignoring bumpstall value %d; should be 0, 1, 2, or 3", this->bumpstall);
-        }
-        else
-        {
-            ROS_INFO("Setting bumpstall to %d", this->bumpstall);
-            P2OSPacket bumpstall_packet;;
-            unsigned char bumpstall_command[4];
-            bumpstall_command[0] = BUMP_STALL;
-            bumpstall_command[1] = ARGINT;
-            bumpstall_command[2] = (unsigned char)this->bumpstall;
-            bumpstall_command[3] = 0;
-            bumpstall_packet.Build(bumpstall_command, 4);
-            this->SendReceive(&bumpstall_packet,false);
-        }
-    }
-    // Turn on the sonar
-    if(use_sonar_)
-    {
-        this->ToggleSonarPower(1);
-        ROS_DEBUG("Sonar array powered on.");
-    }
-    ptz_.setup();
     if (use_arm_)
     {
         ROS_WARN("Arm is not supported in TCP mode");
         use_arm_=false;
     }
+    SendConfiguration();
     ROS_INFO("Completed TCP Setup");
     return(0);
 }
@@ -30,6 +30,8 @@ const int P2OSPtz::MAX_COMMAND_LENGTH = 19;
 const int P2OSPtz::MAX_REQUEST_LENGTH = 17;
 const int P2OSPtz::COMMAND_RESPONSE_BYTES = 6;
 const int P2OSPtz::PACKET_TIMEOUT = 300;
+// seconds to wait for each piece of a reply the control loop reads
+const double P2OSPtz::AUX_WAIT = 0.1;
 const int P2OSPtz::SLEEP_TIME_USEC = 300000;
 const int P2OSPtz::PAN_THRESH = 1;
 const int P2OSPtz::TILT_THRESH = 1;
@@ -215,6 +217,8 @@ void P2OSPtz::callback(const p2os_driver::PTZStateConstPtr &cmd)
         sendAbsZoom(to_send.zoom);
     }
 
+    // published by the control loop
+    PiMutex::scoped_lock lock(p2os_->get_state_mutex());
     current_state_.pan = pan_;
     current_state_.zoom = zoom_;
     current_state_.tilt = tilt_;
@@ -518,6 +522,10 @@ void P2OSPtz::getPtzPacket(int s1, int s2)
     request[2] = s1;
     request[3] = 0;
 
+    // The state lock keeps the link and cb_ to this exchange; it is only let
+    // go while waiting for the control loop to read the reply
+    PiMutex::scoped_lock lock(p2os_->get_state_mutex());
+
     // Reset our receiving buffer.
     cb_.reset();
 
@@ -553,7 +561,7 @@ void P2OSPtz::getPtzPacket(int s1, int s2)
         }
 
         // Keep reading data until we get a response from the camera.
-        p2os_->SendReceive(NULL,false);
+        p2os_->ReceiveAux(lock, AUX_WAIT);
     }
 }
 
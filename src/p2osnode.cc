@@ -22,6 +22,9 @@
  */
 
 #include <iostream>
+#include <sys/mman.h>
+
+#include <boost/thread.hpp>
 
 #include <ros/ros.h>
 #include <tf/transform_datatypes.h>
@@ -29,6 +32,7 @@
 #include <geometry_msgs/PoseStamped.h>
 
 #include <p2os.h>
+#include <control_loop.h>
 #include <p2os_driver/MotorState.h>
 
 int main( int argc, char** argv )
@@ -58,27 +62,61 @@ int main( int argc, char** argv )
 
     p->ResetRawPositions();
 
+    // In real-time mode the control loop gets a SCHED_FIFO thread and locked
+    // memory, publishing gets a thread of its own, and this thread is left
+    // with the ROS callbacks and diagnostics
+    ros::NodeHandle n_private("~");
+    bool realtime;
+    int rt_priority, rt_cpu;
+    n_private.param( "realtime", realtime, false );
+    n_private.param( "realtime_priority", rt_priority, 80 );
+    n_private.param( "realtime_cpu", rt_cpu, -1 );
+
     ros::Rate rate(p->get_frequency());
-    int pulseCounter = 0;
 
-    while( ros::ok() )
+    // The real-time loop must not wait on the link while holding the state
+    // lock, which only the draining and SIP-locked reads avoid
+    if( realtime && !p->get_sip_locked() && !p->get_drain_sips() )
+    {
+        ROS_INFO( "Real-time mode reads the SIPs as with drain_sips" );
+        p->SetDrainSips(true);
+    }
+
+    // Locked to the SIPs or draining, the loop does all the reading itself
+    if( p->get_sip_locked() || p->get_drain_sips() )
+        p->SetSendOnly(true);
+
+    if( realtime )
     {
-        p->check_and_set_vel();
-        p->check_and_set_motor_state();
-        p->check_and_set_gripper_state();
-        p->check_and_set_arm_state(ros::Time::now(),rate.cycleTime(),cm);
+        if( mlockall(MCL_CURRENT | MCL_FUTURE) != 0 )
+            ROS_WARN( "Could not lock the driver's memory; page faults may delay the control loop" );
 
-        pulseCounter++;
-        if ( pulseCounter > p->get_pulse())
+        p->SetDeferPublish(true);
+        boost::thread publisher(publish_thread, p);
+        boost::thread control(control_thread, p, &cm, rt_priority, rt_cpu);
+        while( ros::ok() )
+        {
+            ros::spinOnce();
+            p->updateDiagnostics();
+            rate.sleep();
+        }
+        control.join();
+        publisher.join();
+    }
+    else
+    {
+        ros::Time last = ros::Time::now();
+        while( ros::ok() )
         {
-            p->SendPulse();
-            pulseCounter = 0;
+            if( p->get_sip_locked() )
+                sip_locked_cycle(p, cm, last);
+            else
+                control_cycle(p, cm, rate);
+            p->updateDiagnostics();
+            ros::spinOnce();
+            if( !p->get_sip_locked() )
+                rate.sleep();
         }
-        // Listen at a constant rate
-        p->SendReceive(NULL,true);
-        p->updateDiagnostics();
-        ros::spinOnce();
-        rate.sleep();
     }
 
     if( p->Shutdown() != 0 )
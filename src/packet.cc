@@ -30,6 +30,7 @@
 #include <ros/ros.h>
 
 #include <packet.h>
+#include <metrics.h>
 
 
 void P2OSPacket::Print() {
@@ -54,10 +55,10 @@ void P2OSPacket::PrintHex() {
 
 
 bool P2OSPacket::Check() {
-    short chksum;
+    int chksum;
     chksum = CalcChkSum();
 
-    if ( (chksum == packet[size-2] << 8) | packet[size-1])
+    if ( chksum == ((packet[size-2] << 8) | packet[size-1]) )
         return(true);
 
 
@@ -85,14 +86,18 @@ int P2OSPacket::CalcChkSum() {
 int P2OSPacket::Receive( int fd )
 {
     unsigned char prefix[3];
-    //int skipped=0;
+    int hunted;
     int cnt;
+    bool valid;
 
     memset(packet,0,sizeof(packet));
+    skipped = 0;
+    badChecksums = 0;
 
     do
     {
         memset(prefix,0,sizeof(prefix));
+        hunted = 0;
 
         while(1)
         {
@@ -109,12 +114,15 @@ int P2OSPacket::Receive( int fd )
             if (prefix[0]==0xFA && prefix[1]==0xFB) break;
 
             timestamp = ros::Time::now();
+            headerTime = Metrics::Now();
 
             prefix[0]=prefix[1];
             prefix[1]=prefix[2];
-            //skipped++;
+            hunted++;
         }
-        //if (skipped>3) ROS_INFO("Skipped %d bytes\n", skipped);
+        // the first two bytes shifted through are the header itself
+        if (hunted > 2)
+            skipped += hunted - 2;
 
         size = prefix[2]+3;
         memcpy( packet, prefix, 3);
@@ -128,7 +136,11 @@ int P2OSPacket::Receive( int fd )
                 return(1);
             }
         }
-    } while (!Check());
+
+        valid = Check();
+        if (!valid)
+            badChecksums++;
+    } while (!valid);
     return(0);
 }
 
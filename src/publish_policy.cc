@@ -0,0 +1,56 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <publish_policy.h>
+
+void PublishPolicy::Init( const ros::Publisher &pub, double rate,
+                          bool on_change, double heartbeat )
+{
+    pub_ = pub;
+    if( rate > 0.0 )
+        period_ = ros::Duration(1.0 / rate);
+    else
+        period_ = ros::Duration(0.0);
+    on_change_ = on_change;
+    heartbeat_ = ros::Duration(heartbeat > 0.0 ? heartbeat : 0.0);
+}
+
+bool PublishPolicy::Due( const ros::Time &now, unsigned int value ) const
+{
+    // on-change topics are latched, so they are kept current for whoever
+    // subscribes later
+    if( pub_ && !on_change_ && pub_.getNumSubscribers() == 0 )
+        return false;
+
+    if( last_.isZero() )
+        return true;
+
+    ros::Duration since = now - last_;
+    if( since < period_ )
+        return false;
+
+    if( on_change_ && value == last_value_ )
+        return !heartbeat_.isZero() && since >= heartbeat_;
+
+    return true;
+}
@@ -29,6 +29,7 @@
 #include <stdlib.h> /* for abs() */
 #include <unistd.h>
 #include <sstream>
+#include <algorithm>
 
 #include "tf/tf.h"
 #include "tf/transform_datatypes.h"
@@ -36,58 +37,64 @@
 #include <sip.h>
 
 
-void SIP::FillStandard(ros_p2os_data_t* data)
+void SIP::FillStandard(ros_p2os_data_t* data, unsigned int fields)
 {
     ///////////////////////////////////////////////////////////////
     // odometry
-
-    double px, py, pa;
-
-    // initialize position to current offset
-    px = x_offset / 1e3;
-    py = y_offset / 1e3;
-    // now transform current position by rotation if there is one
-    // and add to offset
-    if(angle_offset != 0)
-    {
-        double rot = DTOR(angle_offset);    // convert rotation to radians
-        px +=  ((xpos/1e3) * cos(rot) - (ypos/1e3) * sin(rot));
-        py +=  ((xpos/1e3) * sin(rot) + (ypos/1e3) * cos(rot));
-        pa = DTOR(angle_offset + angle);
-    }
-    else
+    if(fields & FILL_ODOM)
     {
-        px += xpos / 1e3;
-        py += ypos / 1e3;
-        pa = DTOR(angle);
-    }
+        double px, py, pa;
+
+        // initialize position to current offset
+        px = x_offset / 1e3;
+        py = y_offset / 1e3;
+        // now transform current position by rotation if there is one
+        // and add to offset
+        if(angle_offset != 0)
+        {
+            double rot = DTOR(angle_offset);    // convert rotation to radians
+            px +=  ((xpos/1e3) * cos(rot) - (ypos/1e3) * sin(rot));
+            py +=  ((xpos/1e3) * sin(rot) + (ypos/1e3) * cos(rot));
+            pa = DTOR(angle_offset + angle);
+        }
+        else
+        {
+            px += xpos / 1e3;
+            py += ypos / 1e3;
+            pa = DTOR(angle);
+        }
 
-    data->position.pose.pose.position.x = px;
-    data->position.pose.pose.position.y = py;
-    data->position.pose.pose.position.z = 0.0;
-    data->position.pose.pose.orientation = tf::createQuaternionMsgFromYaw(pa);
+        data->position.pose.pose.position.x = px;
+        data->position.pose.pose.position.y = py;
+        data->position.pose.pose.position.z = 0.0;
+        data->position.pose.pose.orientation = tf::createQuaternionMsgFromYaw(pa);
 
-    // add rates
-    data->position.twist.twist.linear.x = ((lvel + rvel) / 2) / 1e3;
-    data->position.twist.twist.linear.y = 0.0;
-    data->position.twist.twist.angular.z = ((double)(rvel-lvel)/(2.0/PlayerRobotParams[param_idx].DiffConvFactor));
+        // add rates
+        data->position.twist.twist.linear.x = ((lvel + rvel) / 2.0) / 1e3;
+        data->position.twist.twist.linear.y = 0.0;
+        data->position.twist.twist.angular.z = ((double)(rvel-lvel)/(2.0/PlayerRobotParams[param_idx].DiffConvFactor));
 
-    //publish transform
-    data->odom_trans.header = data->position.header;
-    data->odom_trans.child_frame_id = data->position.child_frame_id;
-    data->odom_trans.transform.translation.x = px;
-    data->odom_trans.transform.translation.y = py;
-    data->odom_trans.transform.translation.z = 0;
-    data->odom_trans.transform.rotation = tf::createQuaternionMsgFromYaw(pa);
+        //publish transform
+        data->odom_trans.transform.translation.x = px;
+        data->odom_trans.transform.translation.y = py;
+        data->odom_trans.transform.translation.z = 0;
+        data->odom_trans.transform.rotation = data->position.pose.pose.orientation;
+    }
 
     // battery
-    data->batt.voltage = battery / 10.0;
+    if(fields & FILL_BATTERY)
+    {
+        data->batt.voltage = battery / 10.0;
+    }
 
     // motor state
     // The below will tell us if the motors are currently moving or not, it does
     // not tell us whether they have been enabled
     // data->motors.state = (status & 0x01);
-    data->motors.state = (motors_enabled & 0x01);
+    if(fields & FILL_MOTORS)
+    {
+        data->motors.state = (motors_enabled & 0x01);
+    }
     /*
   ///////////////////////////////////////////////////////////////
   // compass
@@ -97,100 +104,113 @@ void SIP::FillStandard(ros_p2os_data_t* data)
 
     ///////////////////////////////////////////////////////////////
     // sonar
-    data->sonar.ranges_count = static_cast<int>(sonarreadings);
-    data->sonar.ranges.clear();
-    for(int i=0; i < data->sonar.ranges_count; i++)
-        data->sonar.ranges.push_back(sonars[i] / 1e3);
+    if(fields & FILL_SONAR)
+    {
+        // resize() only allocates when a new transducer first shows up
+        data->sonar.ranges_count = static_cast<int>(sonarreadings);
+        data->sonar.ranges.resize(sonarreadings);
+        data->sonar.stamps.resize(sonarreadings);
+        data->sonar.seqs.resize(sonarreadings);
+        for(int i=0; i < data->sonar.ranges_count; i++)
+        {
+            data->sonar.ranges[i] = sonars[i] / 1e3;
+            data->sonar.stamps[i] = sonarStamps[i];
+            data->sonar.seqs[i] = sonarSeqs[i];
+        }
+    }
 
     ///////////////////////////////////////////////////////////////
     // gripper
-    unsigned char gripState = timer;
-    if ((gripState & 0x01) && (gripState & 0x02) && !(gripState & 0x04))
-    {
-        data->gripper.grip.state = PLAYER_GRIPPER_STATE_ERROR;
-        data->gripper.grip.dir = 0;
-    }
-    else if(gripState & 0x04)
-    {
-        data->gripper.grip.state = PLAYER_GRIPPER_STATE_MOVING;
-        if(gripState & 0x01)
-            data->gripper.grip.dir = 1;
-        if(gripState & 0x02)
-            data->gripper.grip.dir = -1;
-    }
-    else if(gripState & 0x01)
+    if(fields & FILL_GRIPPER)
     {
-        data->gripper.grip.state = PLAYER_GRIPPER_STATE_OPEN;
-        data->gripper.grip.dir = 0;
-    }
-    else if(gripState & 0x02)
-    {
-        data->gripper.grip.state = PLAYER_GRIPPER_STATE_CLOSED;
-        data->gripper.grip.dir = 0;
-    }
-
-    // Reset data to false
-    data->gripper.grip.inner_beam = false;
-    data->gripper.grip.outer_beam = false;
-    data->gripper.grip.left_contact = false;
-    data->gripper.grip.right_contact = false;
+        unsigned char gripState = timer;
+        if ((gripState & 0x01) && (gripState & 0x02) && !(gripState & 0x04))
+        {
+            data->gripper.grip.state = PLAYER_GRIPPER_STATE_ERROR;
+            data->gripper.grip.dir = 0;
+        }
+        else if(gripState & 0x04)
+        {
+            data->gripper.grip.state = PLAYER_GRIPPER_STATE_MOVING;
+            if(gripState & 0x01)
+                data->gripper.grip.dir = 1;
+            if(gripState & 0x02)
+                data->gripper.grip.dir = -1;
+        }
+        else if(gripState & 0x01)
+        {
+            data->gripper.grip.state = PLAYER_GRIPPER_STATE_OPEN;
+            data->gripper.grip.dir = 0;
+        }
+        else if(gripState & 0x02)
+        {
+            data->gripper.grip.state = PLAYER_GRIPPER_STATE_CLOSED;
+            data->gripper.grip.dir = 0;
+        }
 
-    if (digin & 0x08)
-    {
-        data->gripper.grip.inner_beam = true;
-    }
-    if (digin & 0x04)
-    {
-        data->gripper.grip.outer_beam = true;
-    }
-    if (!(digin & 0x10))
-    {
-        data->gripper.grip.left_contact = true;
-    }
-    if (!(digin & 0x20))
-    {
-        data->gripper.grip.right_contact = true;
-    }
+        // Reset data to false
+        data->gripper.grip.inner_beam = false;
+        data->gripper.grip.outer_beam = false;
+        data->gripper.grip.left_contact = false;
+        data->gripper.grip.right_contact = false;
 
-    // lift
-    data->gripper.lift.dir = 0;
+        if (digin & 0x08)
+        {
+            data->gripper.grip.inner_beam = true;
+        }
+        if (digin & 0x04)
+        {
+            data->gripper.grip.outer_beam = true;
+        }
+        if (!(digin & 0x10))
+        {
+            data->gripper.grip.left_contact = true;
+        }
+        if (!(digin & 0x20))
+        {
+            data->gripper.grip.right_contact = true;
+        }
 
-    if ((gripState & 0x10) && (gripState & 0x20) && !(gripState & 0x40))
-    {
-        // In this case, the lift is somewhere in between, so
-        // must be at an intermediate carry position. Use last commanded position
-        data->gripper.lift.state = PLAYER_ACTARRAY_ACTSTATE_IDLE;
-        data->gripper.lift.position = lastLiftPos;
-    }
-    else if (gripState & 0x40)  // Moving
-    {
-        data->gripper.lift.state = PLAYER_ACTARRAY_ACTSTATE_MOVING;
-        // There is no way to know where it is for sure, so use last commanded
-        // position.
-        data->gripper.lift.position = lastLiftPos;
-        if (gripState & 0x10)
-            data->gripper.lift.dir = 1;
-        else if (gripState & 0x20)
-            data->gripper.lift.dir = -1;
-    }
-    else if (gripState & 0x10)  // Up
-    {
-        data->gripper.lift.state = PLAYER_ACTARRAY_ACTSTATE_IDLE;
-        data->gripper.lift.position = 1.0f;
-        data->gripper.lift.dir = 0;
-    }
-    else if (gripState & 0x20)  // Down
-    {
-        data->gripper.lift.state = PLAYER_ACTARRAY_ACTSTATE_IDLE;
-        data->gripper.lift.position = 0.0f;
+        // lift
         data->gripper.lift.dir = 0;
+
+        if ((gripState & 0x10) && (gripState & 0x20) && !(gripState & 0x40))
+        {
+            // In this case, the lift is somewhere in between, so
+            // must be at an intermediate carry position. Use last commanded position
+            data->gripper.lift.state = PLAYER_ACTARRAY_ACTSTATE_IDLE;
+            data->gripper.lift.position = lastLiftPos;
+        }
+        else if (gripState & 0x40)  // Moving
+        {
+            data->gripper.lift.state = PLAYER_ACTARRAY_ACTSTATE_MOVING;
+            // There is no way to know where it is for sure, so use last commanded
+            // position.
+            data->gripper.lift.position = lastLiftPos;
+            if (gripState & 0x10)
+                data->gripper.lift.dir = 1;
+            else if (gripState & 0x20)
+                data->gripper.lift.dir = -1;
+        }
+        else if (gripState & 0x10)  // Up
+        {
+            data->gripper.lift.state = PLAYER_ACTARRAY_ACTSTATE_IDLE;
+            data->gripper.lift.position = 1.0f;
+            data->gripper.lift.dir = 0;
+        }
+        else if (gripState & 0x20)  // Down
+        {
+            data->gripper.lift.state = PLAYER_ACTARRAY_ACTSTATE_IDLE;
+            data->gripper.lift.position = 0.0f;
+            data->gripper.lift.dir = 0;
+        }
+        else    // Assume stalled
+        {
+            data->gripper.lift.state = PLAYER_ACTARRAY_ACTSTATE_STALLED;
+        }
+        // Store the last lift position
+        lastLiftPos = data->gripper.lift.position;
     }
-    else    // Assume stalled
-    {
-        data->gripper.lift.state = PLAYER_ACTARRAY_ACTSTATE_STALLED;
-    }
-    // Store the last lift position
-    lastLiftPos = data->gripper.lift.position;
 
     /*
   ///////////////////////////////////////////////////////////////
@@ -213,23 +233,33 @@ void SIP::FillStandard(ros_p2os_data_t* data)
 
     ///////////////////////////////////////////////////////////////
     // digital I/O
-    data->dio.count = 8;
-    data->dio.bits = (unsigned int)this->digin;
+    if(fields & FILL_DIO)
+    {
+        data->dio.count = 8;
+        data->dio.bits = (unsigned int)this->digin;
+    }
 
     ///////////////////////////////////////////////////////////////
     // analog I/O
     //TODO: should do this smarter, based on which analog input is selected
-    data->aio.voltages_count = (unsigned char)1;
-    // if (!data->aio.voltages)
-    //   data->aio.voltages = new float[1];
-    // data->aio.voltages[0] = (this->analog / 255.0) * 5.0;
-    data->aio.voltages.clear();
-    data->aio.voltages.push_back((this->analog / 255.0) * 5.0);
+    if(fields & FILL_AIO)
+    {
+        data->aio.voltages_count = (unsigned char)1;
+        data->aio.voltages.resize(1);
+        data->aio.voltages[0] = (this->analog / 255.0) * 5.0;
+    }
 }
 
-int SIP::PositionChange( unsigned short from, unsigned short to )
+/* Work out the change (in mm) between two raw 12-bit position readings.
+ * [lo, hi] is the range of displacements (in mm) predicted from the wheel
+ * velocities over the time between the two SIPs, and is used to infer how
+ * many times the counter wrapped.  Returns false if the change can't be
+ * reconciled with the prediction. */
+bool SIP::PositionChange( unsigned short from, unsigned short to,
+                          double lo, double hi, int *change )
 {
-    int diff1, diff2;
+    double conv = PlayerRobotParams[param_idx].DistConvFactor;
+    int diff1, diff2, diff;
 
     /* find difference in two directions and pick shortest */
     if ( to > from ) {
@@ -242,94 +272,129 @@ int SIP::PositionChange( unsigned short from, unsigned short to )
     }
 
     if ( abs(diff1) < abs(diff2) )
-        return(diff1);
+        diff = diff1;
     else
-        return(diff2);
+        diff = diff2;
+
+    /* add as many whole wraps as gets us closest to the prediction */
+    double expected = std::min( std::max( diff * conv, lo ), hi );
+    int wraps = (int) rint( (expected / conv - diff) / 4096.0 );
+    diff += wraps * 4096;
+
+    *change = (int) rint( diff * conv );
+
+    /* the prediction gets less certain the further we've travelled */
+    double tolerance = 100.0 + 0.2 * std::max( fabs(lo), fabs(hi) );
+    if ( *change < lo - tolerance || *change > hi + tolerance )
+    {
+        odomRejected++;
+        return(false);
+    }
+
+    if ( wraps != 0 )
+        odomRecovered++;
 
+    return(true);
 }
 
-void SIP::Print()
+// (Re)allocate the sonar arrays to hold num sonars, keeping what's there
+void SIP::ResizeSonars( int num )
 {
-    int i;
+    if(num <= sonarcapacity)
+        return;
 
-    ROS_DEBUG("lwstall:%d rwstall:%d\n", lwstall, rwstall);
-
-    std::stringstream front_bumper_info;
-    for(int i=0;i<5;i++) {
-        front_bumper_info << " "
-                          << static_cast<int>((frontbumpers >> i) & 0x01 );
-    }
-    ROS_DEBUG("Front bumpers:%s", front_bumper_info.str().c_str());
-    std::stringstream rear_bumper_info;
-    for(int i=0;i<5;i++) {
-        rear_bumper_info << " "
-                         << static_cast<int>((rearbumpers >> i) & 0x01 );
-    }
-    ROS_DEBUG("Rear bumpers:%s", rear_bumper_info.str().c_str());
-
-    ROS_DEBUG("status: 0x%x analog: %d param_id: %d ", status, analog, param_idx);
-    std::stringstream status_info;
-    for(i=0;i<11;i++) {
-        status_info << " "
-                    << static_cast<int>((status >> (7-i) ) & 0x01);
-    }
-    ROS_DEBUG("status:%s", status_info.str().c_str());
-    std::stringstream digin_info;
-    for(i=0;i<8;i++) {
-        digin_info << " "
-                   << static_cast<int>((digin >> (7-i) ) & 0x01);
-    }
-    ROS_DEBUG("digin:%s", digin_info.str().c_str());
-    std::stringstream digout_info;
-    for(i=0;i<8;i++) {
-        digout_info << " "
-                    << static_cast<int>((digout >> (7-i) ) & 0x01);
-    }
-    ROS_DEBUG("digout:%s", digout_info.str().c_str());
-    ROS_DEBUG("battery: %d compass: %d sonarreadings: %d\n", battery,
-              compass, sonarreadings);
-    ROS_DEBUG("xpos: %d ypos:%d ptu:%hu timer:%hu\n", xpos, ypos, ptu, timer);
-    ROS_DEBUG("angle: %d lvel: %d rvel: %d control: %d\n", angle, lvel,
-              rvel, control);
-
-    PrintSonars();
-    PrintArmInfo ();
-    PrintArm ();
+    unsigned short *newSonars=new unsigned short[num]();
+    ros::Time *newStamps=new ros::Time[num];
+    unsigned int *newSeqs=new unsigned int[num]();
+    for(int i=0;i<sonarcapacity;i++)
+    {
+        newSonars[i]=sonars[i];
+        newStamps[i]=sonarStamps[i];
+        newSeqs[i]=sonarSeqs[i];
+    }
+    delete[] sonars;
+    delete[] sonarStamps;
+    delete[] sonarSeqs;
+    sonars=newSonars;
+    sonarStamps=newStamps;
+    sonarSeqs=newSeqs;
+    sonarcapacity=num;
 }
 
-void SIP::PrintSonars()
+// The standard SIP fields as text, one line per group
+std::string SIP::Dump()
 {
-    if(sonarreadings <= 0)
-        return;
-    std::stringstream sonar_info;
-    for(int i = 0; i < sonarreadings; i++){
-        sonar_info << " " << static_cast<int>(sonars[i]);
+    int i;
+    std::stringstream out;
+
+    out << "lwstall:" << (int)lwstall << " rwstall:" << (int)rwstall << "\n";
+
+    out << "Front bumpers:";
+    for(i=0;i<5;i++)
+        out << " " << static_cast<int>((frontbumpers >> i) & 0x01 );
+    out << "\nRear bumpers:";
+    for(i=0;i<5;i++)
+        out << " " << static_cast<int>((rearbumpers >> i) & 0x01 );
+
+    out << "\nstatus: 0x" << std::hex << (int)status << std::dec
+        << " analog: " << (int)analog << " param_id: " << param_idx;
+    out << "\nstatus:";
+    for(i=0;i<11;i++)
+        out << " " << static_cast<int>((status >> (7-i) ) & 0x01);
+    out << "\ndigin:";
+    for(i=0;i<8;i++)
+        out << " " << static_cast<int>((digin >> (7-i) ) & 0x01);
+    out << "\ndigout:";
+    for(i=0;i<8;i++)
+        out << " " << static_cast<int>((digout >> (7-i) ) & 0x01);
+
+    out << "\nbattery: " << (int)battery << " compass: " << compass
+        << " sonarreadings: " << (int)sonarreadings;
+    out << "\nxpos: " << xpos << " ypos:" << ypos << " ptu:" << ptu << " timer:" << timer;
+    out << "\nangle: " << angle << " lvel: " << lvel << " rvel: " << rvel
+        << " control: " << control;
+
+    if(sonarreadings > 0)
+    {
+        out << "\nSonars:";
+        for(i = 0; i < sonarreadings; i++)
+            out << " " << static_cast<int>(sonars[i]);
     }
-    ROS_DEBUG("Sonars: %s", sonar_info.str().c_str());
+    return out.str();
+}
+
+void SIP::Print()
+{
+    ROS_DEBUG_NAMED("sip", "%s", Dump().c_str());
+    PrintArmInfo ();
+    PrintArm ();
 }
 
 void SIP::PrintArm ()
 {
-    ROS_DEBUG ("Arm power is %s\tArm is %sconnected\n", (armPowerOn ? "on" : "off"), (armConnected ? "" : "not "));
-    ROS_DEBUG ("Arm joint status:\n");
+    ROS_DEBUG_NAMED("sip", "Arm power is %s\tArm is %sconnected\n", (armPowerOn ? "on" : "off"), (armConnected ? "" : "not "));
+    ROS_DEBUG_NAMED("sip", "Arm joint status:\n");
     for (int ii = 0; ii < 6; ii++)
-        ROS_DEBUG ("Joint %d   %s   %d\n", ii + 1, (armJointMoving[ii] ? "Moving " : "Stopped"), armJointPos[ii]);
+        ROS_DEBUG_NAMED("sip", "Joint %d   %s   %d\n", ii + 1, (armJointMoving[ii] ? "Moving " : "Stopped"), armJointPos[ii]);
 }
 
 void SIP::PrintArmInfo ()
 {
-    ROS_DEBUG ("Arm version:\t%s\n", armVersionString);
-    ROS_DEBUG ("Arm has %d joints:\n", armNumJoints);
-    ROS_DEBUG ("  |\tSpeed\tHome\tMin\tCentre\tMax\tTicks/90\n");
+    if (armVersionString)
+        ROS_DEBUG_NAMED("sip", "Arm version:\t%s\n", armVersionString);
+    ROS_DEBUG_NAMED("sip", "Arm has %d joints:\n", armNumJoints);
+    ROS_DEBUG_NAMED("sip", "  |\tSpeed\tHome\tMin\tCentre\tMax\tTicks/90\n");
     for (int ii = 0; ii < armNumJoints; ii++)
-        ROS_DEBUG ("%d |\t%d\t%d\t%d\t%d\t%d\t%d\n", ii, armJoints[ii].speed, armJoints[ii].home, armJoints[ii].min, armJoints[ii].centre, armJoints[ii].max, armJoints[ii].ticksPer90);
+        ROS_DEBUG_NAMED("sip", "%d |\t%d\t%d\t%d\t%d\t%d\t%d\n", ii, armJoints[ii].speed, armJoints[ii].home, armJoints[ii].min, armJoints[ii].centre, armJoints[ii].max, armJoints[ii].ticksPer90);
 }
 
-void SIP::ParseStandard( unsigned char *buffer )
+void SIP::ParseStandard( unsigned char *buffer, const ros::Time &ts )
 {
     int cnt = 0, change;
     unsigned short newxpos, newypos;
+    short oldangle = angle, oldlvel = lvel, oldrvel = rvel;
 
+    sipCount++;
     status = buffer[cnt];
     cnt += sizeof(unsigned char);
     /*
@@ -344,50 +409,80 @@ void SIP::ParseStandard( unsigned char *buffer )
    * The or'ing will work on either arch.
    */
     newxpos = ((buffer[cnt] | (buffer[cnt+1] << 8)) & 0xEFFF) % 4096; /* 15 ls-bits */
+    cnt += sizeof(short);
+
+    newypos = ((buffer[cnt] | (buffer[cnt+1] << 8)) & 0xEFFF) % 4096; /* 15 ls-bits */
+    cnt += sizeof(short);
+
+    angle = (short)
+            rint(((short)(buffer[cnt] | (buffer[cnt+1] << 8))) * PlayerRobotParams[param_idx].AngleConvFactor * 180.0/M_PI);
+    cnt += sizeof(short);
+
+    lvel = (short)
+            rint(((short)(buffer[cnt] | (buffer[cnt+1] << 8))) * PlayerRobotParams[param_idx].VelConvFactor);
+    cnt += sizeof(short);
+
+    rvel = (short)
+            rint(((short)(buffer[cnt] | (buffer[cnt+1] << 8))) * PlayerRobotParams[param_idx].VelConvFactor);
+    cnt += sizeof(short);
+
+    // Predict the displacement since the last SIP from the mean wheel speed
+    // and heading over the interval.  A small raw change may really be one or
+    // more 4096-count wraps if SIPs were lost.
+    // The robot sends a SIP every cycle, but when they are read says little:
+    // SIPs queued behind a host stall are read back to back, and the first
+    // of them looks late.  So one cycle of motion is expected, and anything
+    // up to the host interval (at most maxLateCycles cycles) is allowed when
+    // a SIP was read late.
+    double expx[2] = { 0.0, 0.0 }, expy[2] = { 0.0, 0.0 };
+    if (!timeStandardSIP.isZero() && ts > timeStandardSIP)
+    {
+        double dt[2];
+        dt[0] = sipCycle;
+        dt[1] = std::min( std::max( (ts - timeStandardSIP).toSec(), sipCycle ),
+                          maxLateCycles * sipCycle );
+        double speed = (oldlvel + oldrvel + lvel + rvel) / 4.0;
+        int dangle = ((angle - oldangle) % 360 + 540) % 360 - 180;
+        double heading = oldangle + dangle / 2.0;
+        heading = DTOR(heading);
+        for (int i = 0; i < 2; i++)
+        {
+            expx[i] = speed * dt[i] * cos(heading);
+            expy[i] = speed * dt[i] * sin(heading);
+        }
+        if (expx[0] > expx[1])
+            std::swap(expx[0], expx[1]);
+        if (expy[0] > expy[1])
+            std::swap(expy[0], expy[1]);
+    }
+    timeStandardSIP = ts;
 
     if (xpos!=INT_MAX)
     {
-        change = (int) rint(PositionChange( rawxpos, newxpos ) * PlayerRobotParams[param_idx].DistConvFactor);
-        if (abs(change)>100)
-            ROS_DEBUG("invalid odometry change [%d]; odometry values are tainted", change);
-        else
+        if (PositionChange( rawxpos, newxpos, expx[0], expx[1], &change ))
             xpos += change;
+        else
+            ROS_DEBUG("invalid odometry change [%d], expected [%.0f, %.0f]; odometry values are tainted",
+                      change, expx[0], expx[1]);
     }
     else
     {
         xpos = 0;
     }
     rawxpos = newxpos;
-    cnt += sizeof(short);
-
-    newypos = ((buffer[cnt] | (buffer[cnt+1] << 8)) & 0xEFFF) % 4096; /* 15 ls-bits */
 
     if (ypos!=INT_MAX) {
-        change = (int) rint(PositionChange( rawypos, newypos ) *
-                            PlayerRobotParams[param_idx].DistConvFactor);
-        if (abs(change)>100)
-            ROS_DEBUG("invalid odometry change [%d]; odometry values are tainted", change);
-        else
+        if (PositionChange( rawypos, newypos, expy[0], expy[1], &change ))
             ypos += change;
+        else
+            ROS_DEBUG("invalid odometry change [%d], expected [%.0f, %.0f]; odometry values are tainted",
+                      change, expy[0], expy[1]);
     }
     else
     {
         ypos = 0;
     }
     rawypos = newypos;
-    cnt += sizeof(short);
-
-    angle = (short)
-            rint(((short)(buffer[cnt] | (buffer[cnt+1] << 8))) * PlayerRobotParams[param_idx].AngleConvFactor * 180.0/M_PI);
-    cnt += sizeof(short);
-
-    lvel = (short)
-            rint(((short)(buffer[cnt] | (buffer[cnt+1] << 8))) * PlayerRobotParams[param_idx].VelConvFactor);
-    cnt += sizeof(short);
-
-    rvel = (short)
-            rint(((short)(buffer[cnt] | (buffer[cnt+1] << 8))) * PlayerRobotParams[param_idx].VelConvFactor);
-    cnt += sizeof(short);
 
     battery = buffer[cnt];
     cnt += sizeof(unsigned char);
@@ -418,35 +513,30 @@ void SIP::ParseStandard( unsigned char *buffer )
     unsigned char numSonars=buffer[cnt];
     cnt+=sizeof(unsigned char);
 
-    if(numSonars > 0)
+    // sonarsUpdated builds up until the node has published the readings,
+    // so none are lost with SIPs that are parsed but not published
+    for(unsigned char i=0;i<numSonars;i++)
     {
-        //find the largest sonar index supplied
-        unsigned char maxSonars = sonarreadings;
-        for(unsigned char i=0; i<numSonars; i++)
-        {
-            unsigned char sonarIndex=buffer[cnt+i*(sizeof(unsigned char)+sizeof(unsigned short))];
-            if((sonarIndex+1)>maxSonars) maxSonars=sonarIndex+1;
-        }
+        unsigned char sonarIndex=buffer[cnt];
 
-        //if necessary make more space in the array and preserve existing readings
-        if(maxSonars>sonarreadings)
+        // only happens if the robot has more sonars than its parameters say
+        if(sonarIndex>=sonarcapacity)
         {
-            unsigned short *newSonars=new unsigned short[maxSonars];
-            for(unsigned char i=0;i<sonarreadings;i++)
-                newSonars[i]=sonars[i];
-            if(sonars!=NULL) delete[] sonars;
-            sonars=newSonars;
-            sonarreadings=maxSonars;
+            ROS_WARN("Sonar %d reported but robot parameters only list %d sonars",
+                     sonarIndex, PlayerRobotParams[param_idx].SonarNum);
+            ResizeSonars(sonarIndex+1);
         }
+        if(sonarIndex>=sonarreadings)
+            sonarreadings=sonarIndex+1;
 
-        //update the sonar readings array with the new readings
-        for(unsigned char i=0;i<numSonars;i++)
-        {
-            sonars[buffer[cnt]]=   (unsigned short)
-                    rint((buffer[cnt+1] | (buffer[cnt+2] << 8)) *
-                         PlayerRobotParams[param_idx].RangeConvFactor);
-            cnt+=sizeof(unsigned char)+sizeof(unsigned short);
-        }
+        sonars[sonarIndex]=   (unsigned short)
+                rint((buffer[cnt+1] | (buffer[cnt+2] << 8)) *
+                     PlayerRobotParams[param_idx].RangeConvFactor);
+        sonarStamps[sonarIndex] = ts;
+        sonarSeqs[sonarIndex]++;
+        if(sonarIndex < 32)
+            sonarsUpdated |= 1u << sonarIndex;
+        cnt+=sizeof(unsigned char)+sizeof(unsigned short);
     }
 
     timer = (buffer[cnt] | (buffer[cnt+1] << 8));
@@ -460,9 +550,9 @@ void SIP::ParseStandard( unsigned char *buffer )
 
     digout = buffer[cnt];
     cnt += sizeof(unsigned char);
-    // for debugging:
-    Print();
-    // PrintSonars();
+    // for debugging: the macro only evaluates Dump() when the "sip" logger
+    // is enabled at debug level and printPeriod has passed
+    ROS_DEBUG_THROTTLE_NAMED(printPeriod, "sip", "%s", Dump().c_str());
 }
 
 /** Parse a SERAUX SIP packet.  For a CMUcam, this will have blob
@@ -683,3 +773,72 @@ void SIP::ParseArmInfo (unsigned char *buffer)
         armJoints[ii].ticksPer90 = buffer[dataOffset + (ii * 6) + 5];
     }
 }
+
+// Skips the NUL-terminated string at pos; false if it runs past end
+static bool skip_string(unsigned char *buffer, int end, int &pos)
+{
+    while (pos < end && buffer[pos] != 0)
+        pos++;
+    pos++;
+    return pos <= end;
+}
+
+static unsigned short get_uint2(unsigned char *buffer, int &pos)
+{
+    unsigned short value = buffer[pos] | (buffer[pos + 1] << 8);
+    pos += 2;
+    return value;
+}
+
+// Field layout as read by ARIA's ArRobotConfigPacketReader
+void SIP::ParseConfig (unsigned char *buffer)
+{
+    // buffer[0] counts the bytes after it, the checksum included
+    int end = (int) buffer[0] - 1;
+    int pos = 2;
+
+    if (buffer[1] != CONFIGPAC)
+    {
+        ROS_ERROR ("Attempt to parse a non CONFIG packet as config.");
+        return;
+    }
+
+    // robot type, subtype and serial number
+    if (!skip_string (buffer, end, pos) || !skip_string (buffer, end, pos) ||
+        !skip_string (buffer, end, pos))
+    {
+        ROS_DEBUG ("CONFIGpac too short");
+        return;
+    }
+    // 4MOTS flag, velocity and acceleration tops, PWM max
+    pos += 1 + 5 * 2;
+    // robot name
+    if (pos > end || !skip_string (buffer, end, pos))
+    {
+        ROS_DEBUG ("CONFIGpac too short");
+        return;
+    }
+    // SIP cycle (ms)
+    if (pos < end && buffer[pos] > 0)
+        sipCycle = buffer[pos] / 1000.0;
+    // baud rates, gripper, sonar, battery, encoder, watchdog, stall and
+    // joystick settings, max velocities
+    pos += 27;
+    if (pos + 10 * 2 > end)
+    {
+        ROS_DEBUG ("CONFIGpac too short");
+        return;
+    }
+
+    config.rotAccel = get_uint2 (buffer, pos);
+    config.rotDecel = get_uint2 (buffer, pos);
+    config.rotKP = get_uint2 (buffer, pos);
+    config.rotKV = get_uint2 (buffer, pos);
+    config.rotKI = get_uint2 (buffer, pos);
+    config.transAccel = get_uint2 (buffer, pos);
+    config.transDecel = get_uint2 (buffer, pos);
+    config.transKP = get_uint2 (buffer, pos);
+    config.transKV = get_uint2 (buffer, pos);
+    config.transKI = get_uint2 (buffer, pos);
+    configReceived = true;
+}
@@ -0,0 +1,145 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <math.h>
+
+#include <angles/angles.h>
+#include <tf/tf.h>
+
+#include <velocity_estimator.h>
+
+// Pose differences over a longer gap than this (s) are not trusted, e.g.
+// after a reconnect
+#define VELOCITY_MAX_GAP 1.0
+
+// Variance reported for the velocities a differential drive can't have
+#define VELOCITY_CONSTRAINED_VAR 1e-9
+
+VelocityEstimator::VelocityEstimator() :
+    mode_(WHEELS), tau_(0.0),
+    last_x_(0.0), last_y_(0.0), last_th_(0.0)
+{
+    wheel_var_[0] = wheel_var_[1] = 0.0;
+    pose_var_[0] = pose_var_[1] = 0.0;
+    vel_[0] = vel_[1] = 0.0;
+    var_[0] = var_[1] = 0.0;
+}
+
+bool VelocityEstimator::Init( const std::string &mode, double cutoff,
+                              double wheel_linear_var, double wheel_angular_var,
+                              double pose_linear_var, double pose_angular_var )
+{
+    bool ok = true;
+
+    if( mode == "pose" )
+        mode_ = POSE;
+    else if( mode == "fused" )
+        mode_ = FUSED;
+    else
+    {
+        mode_ = WHEELS;
+        ok = (mode == "wheels");
+    }
+
+    tau_ = cutoff > 0.0 ? 1.0 / (2.0 * M_PI * cutoff) : 0.0;
+    wheel_var_[0] = wheel_linear_var;
+    wheel_var_[1] = wheel_angular_var;
+    pose_var_[0] = pose_linear_var;
+    pose_var_[1] = pose_angular_var;
+    Reset();
+
+    return ok;
+}
+
+void VelocityEstimator::Update( const ros::Time &ts, double dt, nav_msgs::Odometry &odom )
+{
+    double x = odom.pose.pose.position.x;
+    double y = odom.pose.pose.position.y;
+    double th = tf::getYaw(odom.pose.pose.orientation);
+    double gap = last_.isZero() ? 0.0 : (ts - last_).toSec();
+    bool valid = !last_.isZero() && dt > 0.0 && gap < VELOCITY_MAX_GAP;
+
+    double vel[2], var[2];
+    vel[0] = odom.twist.twist.linear.x;
+    vel[1] = odom.twist.twist.angular.z;
+    var[0] = wheel_var_[0];
+    var[1] = wheel_var_[1];
+
+    // until there are two poses to difference, the wheel speeds are all
+    // there is
+    if( mode_ != WHEELS && valid )
+    {
+        double dth = angles::normalize_angle(th - last_th_);
+        double mid = last_th_ + dth / 2.0;
+        double pose_vel[2];
+        pose_vel[0] = ((x - last_x_) * cos(mid) + (y - last_y_) * sin(mid)) / dt;
+        pose_vel[1] = dth / dt;
+
+        for( int i = 0; i < 2; i++ )
+        {
+            if( mode_ == POSE )
+            {
+                vel[i] = pose_vel[i];
+                var[i] = pose_var_[i];
+            }
+            else if( var[i] + pose_var_[i] > 0.0 )
+            {
+                vel[i] = (vel[i] * pose_var_[i] + pose_vel[i] * var[i]) /
+                         (var[i] + pose_var_[i]);
+                var[i] = var[i] * pose_var_[i] / (var[i] + pose_var_[i]);
+            }
+        }
+    }
+
+    for( int i = 0; i < 2; i++ )
+    {
+        if( tau_ > 0.0 && valid )
+        {
+            // an exponential average of white noise has a/(2-a) of its variance
+            double a = dt / (dt + tau_);
+            vel_[i] += a * (vel[i] - vel_[i]);
+            var_[i] = var[i] * a / (2.0 - a);
+        }
+        else
+        {
+            vel_[i] = vel[i];
+            var_[i] = var[i];
+        }
+    }
+
+    last_ = ts;
+    last_x_ = x;
+    last_y_ = y;
+    last_th_ = th;
+
+    odom.twist.twist.linear.x = vel_[0];
+    odom.twist.twist.angular.z = vel_[1];
+    for( int i = 0; i < 36; i++ )
+        odom.twist.covariance[i] = 0.0;
+    odom.twist.covariance[0]  = var_[0];
+    odom.twist.covariance[7]  = VELOCITY_CONSTRAINED_VAR;
+    odom.twist.covariance[14] = VELOCITY_CONSTRAINED_VAR;
+    odom.twist.covariance[21] = VELOCITY_CONSTRAINED_VAR;
+    odom.twist.covariance[28] = VELOCITY_CONSTRAINED_VAR;
+    odom.twist.covariance[35] = var_[1];
+}
@@ -0,0 +1,107 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include <velocity_smoother.h>
+
+VelocitySmoother::VelocitySmoother()
+{
+    for( int i = 0; i < AXES; i++ )
+        accel_[i] = jerk_[i] = 0.0;
+    Reset();
+}
+
+void VelocitySmoother::Init( const double accel[AXES], const double jerk[AXES] )
+{
+    for( int i = 0; i < AXES; i++ )
+    {
+        accel_[i] = accel[i] > 0.0 ? accel[i] : 0.0;
+        jerk_[i] = jerk[i] > 0.0 ? jerk[i] : 0.0;
+    }
+    Reset();
+}
+
+void VelocitySmoother::Reset()
+{
+    for( int i = 0; i < AXES; i++ )
+        vel_[i] = acc_[i] = target_[i] = 0.0;
+}
+
+void VelocitySmoother::Update( double dt, double targets[AXES] )
+{
+    for( int i = 0; i < AXES; i++ )
+    {
+        target_[i] = targets[i];
+
+        if( accel_[i] <= 0.0 || jerk_[i] <= 0.0 || dt <= 0.0 )
+        {
+            vel_[i] = targets[i];
+            acc_[i] = 0.0;
+            continue;
+        }
+
+        double err = targets[i] - vel_[i];
+
+        // the most acceleration that can still be ramped back down to zero,
+        // one jerk limited step per update, just as the remaining error is
+        // used up: (n + f) * step, then n steps down to f * step and zero,
+        // covers dt * step * (n + 1)(n/2 + f) of it
+        double step = jerk_[i] * dt;
+        double e = fabs(err) / (dt * step);
+        double n = floor((sqrt(1.0 + 8.0 * e) - 1.0) / 2.0);
+        double f = std::max(0.0, std::min(1.0, e / (n + 1.0) - n / 2.0));
+        double want = std::min(accel_[i], (n + f) * step);
+        if( err < 0.0 )
+            want = -want;
+
+        acc_[i] += std::max(-step, std::min(step, want - acc_[i]));
+        vel_[i] += acc_[i] * dt;
+
+        if( err == 0.0 )
+        {
+            // a step after arriving: stop accelerating
+            vel_[i] = targets[i];
+            acc_[i] = 0.0;
+        }
+        else if( (err > 0.0 && vel_[i] >= targets[i]) ||
+                 (err < 0.0 && vel_[i] <= targets[i]) )
+        {
+            // don't overshoot: arrive, with the acceleration that took, so
+            // the next step ramps on from there
+            vel_[i] = targets[i];
+            acc_[i] = err / dt;
+        }
+
+        targets[i] = vel_[i];
+    }
+}
+
+bool VelocitySmoother::Settled() const
+{
+    for( int i = 0; i < AXES; i++ )
+        if( vel_[i] != target_[i] || acc_[i] != 0.0 )
+            return false;
+    return true;
+}
@@ -0,0 +1,42 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ALLOCATION_COUNTER_H
+#define _ALLOCATION_COUNTER_H
+
+// Counts the heap allocations made by the whole test binary since it was
+// constructed.  Linking allocation_counter.cc replaces the global operator
+// new to do the counting.
+class AllocationCounter
+{
+  public:
+    AllocationCounter() : start_(Total()) {}
+
+    unsigned long Allocations() const { return Total() - start_; }
+    static unsigned long Total();
+
+  private:
+    unsigned long start_;
+};
+
+#endif
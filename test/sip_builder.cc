@@ -0,0 +1,70 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <robot_params.h>
+
+#include "sip_builder.h"
+
+int MakeSIP( unsigned char *buffer, int param_idx, double x, double speed,
+             int first, int sonars, unsigned short timer )
+{
+    const RobotParams_t &params = PlayerRobotParams[param_idx];
+    int cnt = 0;
+
+    memset(buffer, 0, SIP_BUFFER_LEN);
+    buffer[cnt++] = 0x32;
+
+    int rawx = ((int) rint(x / params.DistConvFactor)) & 0x0FFF;
+    buffer[cnt++] = rawx & 0xFF;
+    buffer[cnt++] = rawx >> 8;
+    cnt += 2;   // ypos
+    cnt += 2;   // angle
+
+    short vel = (short) rint(speed / params.VelConvFactor);
+    for (int i = 0; i < 2; i++)
+    {
+        buffer[cnt++] = vel & 0xFF;
+        buffer[cnt++] = (vel >> 8) & 0xFF;
+    }
+
+    buffer[cnt++] = 120;    // battery
+    cnt += 1 + 1 + 2;       // stalls, control
+    buffer[cnt++] = 0x01;   // motors enabled
+    cnt += 1 + 1;           // sonar flag, compass
+
+    buffer[cnt++] = sonars;
+    for (int i = 0; i < sonars; i++)
+    {
+        buffer[cnt++] = (first + i) % params.SonarNum;
+        buffer[cnt++] = 0xE8;  // 1000 range units
+        buffer[cnt++] = 0x03;
+    }
+
+    buffer[cnt++] = timer & 0xFF;
+    buffer[cnt++] = timer >> 8;
+    cnt += 1 + 1 + 1;       // analog, digin, digout
+    return cnt;
+}
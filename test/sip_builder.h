@@ -0,0 +1,41 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _SIP_BUILDER_H
+#define _SIP_BUILDER_H
+
+// p3dx-sh, see robot_params.cc
+const int P3DX_SH = 16;
+
+// Room for a standard SIP reporting every sonar of any robot
+#define SIP_BUFFER_LEN 128
+
+// Builds the body of a standard SIP (from the packet type on, as
+// SIP::ParseStandard() takes it) for a robot at x (mm) along its x axis,
+// heading 0, both wheels at speed (mm/s), motors on and 12 V battery.  The
+// transducers first..first+sonars-1 (modulo the robot's SonarNum) report
+// 1000 range units, and timer goes in the timer field.  Returns the length.
+int MakeSIP( unsigned char *buffer, int param_idx, double x, double speed,
+             int first = 0, int sonars = 0, unsigned short timer = 0 );
+
+#endif
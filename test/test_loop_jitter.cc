@@ -0,0 +1,313 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+#include <p2os.h>
+#include <control_loop.h>
+
+#include "sip_builder.h"
+
+// The fake robot's SIP period, shorter than a real robot's so the benchmark
+// doesn't take long
+static const double SIP_PERIOD = 0.01;
+
+// A node whose link to the robot is one end of a socket pair, set up as
+// p2osnode sets up a real-time, SIP-locked node (see loop_jitter.test) once
+// a P3-DX has connected
+class LinkedNode : public P2OSNode
+{
+  public:
+    LinkedNode( ros::NodeHandle n, int fd ) : P2OSNode(n)
+    {
+        psos_fd = fd;
+        sippacket = NULL;
+        param_idx = P3DX_SH;
+        ConfigureForRobot();
+        // no commands until a callback asks for them
+        vel_dirty = false;
+        motor_dirty = false;
+        gripper_dirty_ = false;
+        SetSendOnly(true);
+        SetDeferPublish(true);
+    }
+
+    ~LinkedNode()
+    {
+        delete sippacket;
+    }
+
+    // the timer field of the SIP last used, which FakeRobot numbers them by
+    unsigned short LastSIP()
+    {
+        PiMutex::scoped_lock lock(get_state_mutex());
+        return sippacket->timer;
+    }
+};
+
+// How many of the fake robot's latest SIPs it remembers sending
+static const int SENT_RING = 1024;
+
+// Sends a SIP every SIP_PERIOD on the other end of the link, numbered in
+// its timer field, and throws the driver's commands away
+class FakeRobot
+{
+  public:
+    FakeRobot( int fd ) : fd_(fd), stop_(false)
+    {
+        for (int i = 0; i < SENT_RING; i++)
+            sent_[i].store(0);
+        thread_ = boost::thread(&FakeRobot::Run, this);
+    }
+
+    ~FakeRobot()
+    {
+        stop_ = true;
+        thread_.join();
+    }
+
+    // when SIP number seq was written, see Metrics::Now()
+    uint64_t Sent( unsigned short seq ) const { return sent_[seq % SENT_RING].load(); }
+
+  private:
+    void Run()
+    {
+        unsigned char body[SIP_BUFFER_LEN], junk[256];
+        P2OSPacket packet;
+        struct timespec next;
+
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        for (int i = 0; !stop_; i++)
+        {
+            next.tv_nsec += (long) (SIP_PERIOD * 1e9);
+            if (next.tv_nsec >= 1000000000L)
+            {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000L;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+            while (recv(fd_, junk, sizeof(junk), MSG_DONTWAIT) > 0)
+                ;
+            unsigned short seq = (unsigned short) i;
+            packet.Build(body, MakeSIP(body, P3DX_SH, 50.0 * i, 500.0, 4 * i, 4, seq));
+            sent_[seq % SENT_RING].store(Metrics::Now());
+            send(fd_, packet.packet, packet.size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+    }
+
+    int fd_;
+    boost::atomic<bool> stop_;
+    boost::atomic<uint64_t> sent_[SENT_RING];
+    boost::thread thread_;
+};
+
+// Keeps every CPU busy at normal priority, plus one thread that holds the
+// state lock for half a millisecond at a time, like a slow callback
+class SyntheticLoad
+{
+  public:
+    SyntheticLoad( P2OSNode &node ) : node_(node), stop_(false)
+    {
+        int cpus = std::max(1, (int) boost::thread::hardware_concurrency());
+        for (int i = 0; i < cpus; i++)
+            threads_.create_thread(boost::bind(&SyntheticLoad::Spin, this));
+        threads_.create_thread(boost::bind(&SyntheticLoad::HoldLock, this));
+    }
+
+    ~SyntheticLoad()
+    {
+        stop_ = true;
+        threads_.join_all();
+    }
+
+  private:
+    void Spin()
+    {
+        volatile double x = 0.0;
+        while (!stop_)
+            for (int i = 0; i < 10000; i++)
+                x += 1e-9 * i;
+    }
+
+    void HoldLock()
+    {
+        while (!stop_)
+        {
+            {
+                PiMutex::scoped_lock lock(node_.get_state_mutex());
+                uint64_t until = Metrics::Now() + 500000;
+                while (Metrics::Now() < until)
+                    ;
+            }
+            boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+        }
+    }
+
+    P2OSNode &node_;
+    boost::atomic<bool> stop_;
+    boost::thread_group threads_;
+};
+
+// Publishes for the node, as publish_thread() does in real-time mode
+class Publisher
+{
+  public:
+    Publisher( P2OSNode &node ) : node_(node), stop_(false)
+    {
+        thread_ = boost::thread(&Publisher::Run, this);
+    }
+
+    ~Publisher()
+    {
+        stop_ = true;
+        thread_.join();
+    }
+
+  private:
+    void Run()
+    {
+        while (!stop_)
+            node_.PublishPending(0.01);
+    }
+
+    P2OSNode &node_;
+    boost::atomic<bool> stop_;
+    boost::thread thread_;
+};
+
+struct LoopRun
+{
+    bool realtime;
+    // for each cycle that used a new SIP, from the robot sending that SIP to
+    // the cycle's commands having gone out, in s
+    std::vector<double> latencies;
+};
+
+// Runs SIP-locked cycles at SCHED_FIFO priority if it is allowed, as the
+// real-time control thread does
+static void RunLoop( LinkedNode *node, FakeRobot *robot, int cycles, LoopRun *run )
+{
+    struct sched_param param;
+    param.sched_priority = 80;
+    run->realtime = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+
+    controller_manager::ControllerManager cm(node);
+    ros::Time last = ros::Time::now();
+    unsigned short used = node->LastSIP();
+    run->latencies.reserve(cycles);
+    for (int i = 0; i < cycles; i++)
+    {
+        sip_locked_cycle(node, cm, last);
+        uint64_t now = Metrics::Now();
+
+        // a cycle the robot went quiet for answered no SIP
+        unsigned short seq = node->LastSIP();
+        if (seq == used)
+            continue;
+        used = seq;
+        run->latencies.push_back((now - robot->Sent(seq)) * 1e-9);
+    }
+}
+
+static double Percentile( std::vector<double> sorted, double p )
+{
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+}
+
+static LoopRun Measure( LinkedNode &node, FakeRobot &robot, int cycles, const char *name )
+{
+    LoopRun run;
+    boost::thread loop(RunLoop, &node, &robot, cycles, &run);
+    loop.join();
+    if (run.latencies.empty())
+    {
+        printf("%s: no SIP answered\n", name);
+        return run;
+    }
+
+    double sum = 0.0;
+    for (size_t i = 0; i < run.latencies.size(); i++)
+        sum += run.latencies[i];
+    printf("%s (%s): mean %.3f ms, median %.3f ms, 99%% %.3f ms, max %.3f ms\n",
+           name, run.realtime ? "SCHED_FIFO" : "normal priority",
+           sum / run.latencies.size() * 1e3, Percentile(run.latencies, 0.5) * 1e3,
+           Percentile(run.latencies, 0.99) * 1e3, Percentile(run.latencies, 1.0) * 1e3);
+    return run;
+}
+
+// How long after the robot sends a SIP the SIP-locked loop has answered it,
+// idle and with every CPU busy and the state lock contended.  The numbers
+// are reported; the loop only has to keep up with the robot.
+TEST(LoopJitter, SIPLockedUnderLoad)
+{
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    ros::NodeHandle n;
+    const int cycles = 300;
+    {
+        LinkedNode node(n, fds[0]);
+        Publisher publisher(node);
+        FakeRobot robot(fds[1]);
+
+        Measure(node, robot, 20, "warmup");
+        LoopRun idle = Measure(node, robot, cycles, "idle");
+        // nearly every cycle answers a SIP of its own
+        ASSERT_GT(idle.latencies.size(), (size_t) cycles * 9 / 10);
+        RecordProperty("idle_p99_us", (int) rint(Percentile(idle.latencies, 0.99) * 1e6));
+        RecordProperty("idle_max_us", (int) rint(Percentile(idle.latencies, 1.0) * 1e6));
+
+        LoopRun loaded;
+        {
+            SyntheticLoad load(node);
+            loaded = Measure(node, robot, cycles, "loaded");
+        }
+        ASSERT_GT(loaded.latencies.size(), (size_t) cycles * 9 / 10);
+        RecordProperty("loaded_p99_us", (int) rint(Percentile(loaded.latencies, 0.99) * 1e6));
+        RecordProperty("loaded_max_us", (int) rint(Percentile(loaded.latencies, 1.0) * 1e6));
+
+        EXPECT_LT(Percentile(idle.latencies, 0.5), SIP_PERIOD);
+        EXPECT_LT(Percentile(loaded.latencies, 0.5), SIP_PERIOD);
+    }
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main( int argc, char **argv )
+{
+    testing::InitGoogleTest(&argc, argv);
+    ros::init(argc, argv, "test_loop_jitter");
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,179 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <stdio.h>
+#include <gtest/gtest.h>
+
+#include <p2os.h>
+
+#include "allocation_counter.h"
+#include "sip_builder.h"
+
+// Feeds SIPs through the same parse, fill and publish path as
+// SendReceive(), without a robot
+class ReplayNode : public P2OSNode
+{
+  public:
+    // configured for a P3-DX the way SetupSerial() does once the robot has
+    // named itself, so the sonar outputs are sized and laid out
+    ReplayNode( ros::NodeHandle n ) : P2OSNode(n)
+    {
+        sippacket = NULL;
+        param_idx = P3DX_SH;
+        ConfigureForRobot();
+    }
+
+    ~ReplayNode()
+    {
+        delete sippacket;
+    }
+
+    void Replay( unsigned char *buffer, const ros::Time &ts )
+    {
+        sippacket->ParseStandard(buffer, ts);
+        UseSIP(ts, true);
+    }
+};
+
+// Replays count SIPs and returns the heap allocations per SIP
+static double AllocationsPerSIP( ReplayNode &node, int first, int count )
+{
+    unsigned char buffer[SIP_BUFFER_LEN];
+
+    AllocationCounter counter;
+    for (int i = first; i < first + count; i++)
+    {
+        // driving forward at 0.5 m/s, four sonars a SIP
+        MakeSIP(buffer, P3DX_SH, 50.0 * i, 500.0, 4 * i, 4);
+        node.Replay(buffer, ros::Time::now());
+    }
+    return (double) counter.Allocations() / count;
+}
+
+// Messages of type M received since the last reset
+template <class M>
+static int &Received()
+{
+    static int count = 0;
+    return count;
+}
+
+template <class M>
+static void Count( const boost::shared_ptr<M const> & )
+{
+    Received<M>()++;
+}
+
+static void ResetReceived()
+{
+    Received<nav_msgs::Odometry>() = 0;
+    Received<p2os_driver::BatteryState>() = 0;
+    Received<p2os_driver::MotorState>() = 0;
+    Received<p2os_driver::GripperState>() = 0;
+    Received<p2os_driver::SonarArray>() = 0;
+    Received<sensor_msgs::PointCloud2>() = 0;
+    Received<sensor_msgs::Range>() = 0;
+    Received<p2os_driver::AIO>() = 0;
+    Received<p2os_driver::DIO>() = 0;
+}
+
+static int TotalReceived()
+{
+    return Received<nav_msgs::Odometry>() + Received<p2os_driver::BatteryState>() +
+        Received<p2os_driver::MotorState>() + Received<p2os_driver::GripperState>() +
+        Received<p2os_driver::SonarArray>() + Received<sensor_msgs::PointCloud2>() +
+        Received<sensor_msgs::Range>() + Received<p2os_driver::AIO>() +
+        Received<p2os_driver::DIO>();
+}
+
+// Lets the subscriptions catch up with what has been published
+static void Deliver()
+{
+    for (int i = 0; i < 10; i++)
+    {
+        ros::WallDuration(0.05).sleep();
+        ros::spinOnce();
+    }
+}
+
+// What roscpp may allocate to publish one message to a subscriber in the same
+// process: the serialization buffer, the SerializedMessage and its
+// deserializer, and the subscription queue's entry and callback.  None of it
+// is the driver's.
+const int ROSCPP_ALLOCATIONS_PER_MESSAGE = 8;
+
+// With nobody listening (and tf off, see publish_allocations.test) the
+// driver's side of a SIP cycle must not allocate.  With every output
+// subscribed the only allocations left are roscpp's, at most
+// ROSCPP_ALLOCATIONS_PER_MESSAGE for each message the subscribers receive.
+TEST(PublishAllocations, ReplaySIPs)
+{
+    ros::NodeHandle n;
+    ReplayNode node(n);
+    const int warmup = 20, count = 200;
+
+    AllocationsPerSIP(node, 0, warmup);
+    double idle = AllocationsPerSIP(node, warmup, count);
+    printf("allocations per SIP, no subscribers: %.2f\n", idle);
+    RecordProperty("allocations_per_sip_idle", (int) rint(idle * 100));
+    EXPECT_EQ(0.0, idle);
+
+    // queues deep enough to keep every message of a run
+    const int queue = 8 * (warmup + count);
+    std::vector<ros::Subscriber> subs;
+    subs.push_back(n.subscribe("pose", queue, Count<nav_msgs::Odometry>));
+    subs.push_back(n.subscribe("battery_state", queue, Count<p2os_driver::BatteryState>));
+    subs.push_back(n.subscribe("motor_state", queue, Count<p2os_driver::MotorState>));
+    subs.push_back(n.subscribe("gripper_state", queue, Count<p2os_driver::GripperState>));
+    subs.push_back(n.subscribe("sonar_array", queue, Count<p2os_driver::SonarArray>));
+    subs.push_back(n.subscribe("sonar_cloud", queue, Count<sensor_msgs::PointCloud2>));
+    subs.push_back(n.subscribe("sonar", queue, Count<sensor_msgs::Range>));
+    subs.push_back(n.subscribe("aio", queue, Count<p2os_driver::AIO>));
+    subs.push_back(n.subscribe("dio", queue, Count<p2os_driver::DIO>));
+    ros::WallDuration(0.5).sleep();
+    ros::spinOnce();
+
+    AllocationsPerSIP(node, warmup + count, warmup);
+    Deliver();
+    ResetReceived();
+    double busy = AllocationsPerSIP(node, 2 * warmup + count, count);
+    Deliver();
+    double messages = (double) TotalReceived() / count;
+    printf("allocations per SIP, all outputs subscribed: %.2f for %.2f messages\n",
+           busy, messages);
+    RecordProperty("allocations_per_sip_subscribed", (int) rint(busy * 100));
+
+    // every output the SIPs feed was published, sonar included
+    EXPECT_EQ(count, Received<nav_msgs::Odometry>());
+    EXPECT_GT(Received<p2os_driver::SonarArray>(), 0);
+    EXPECT_GT(Received<sensor_msgs::PointCloud2>(), 0);
+    EXPECT_EQ(4 * count, Received<sensor_msgs::Range>());
+    EXPECT_LE(busy, ROSCPP_ALLOCATIONS_PER_MESSAGE * messages);
+}
+
+int main( int argc, char **argv )
+{
+    testing::InitGoogleTest(&argc, argv);
+    ros::init(argc, argv, "test_publish_allocations");
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,200 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <gtest/gtest.h>
+
+#include <p2os.h>
+
+#include "allocation_counter.h"
+#include "sip_builder.h"
+
+// Replays a robot driving at speed for duration seconds, with the host
+// stalled for stall seconds half way through.  SIPs sent during the stall
+// queue up and are all read just after it, so their read times say nothing
+// about when they were sent.  With an estimator, each SIP's velocity is
+// estimated as UseSIP() does and the largest error (m/s) is returned.
+static double Replay( SIP &sip, int param_idx, double speed, double duration, double stall,
+                      VelocityEstimator *estimator = NULL )
+{
+    unsigned char buffer[SIP_BUFFER_LEN];
+    ros_p2os_data_t data;
+    unsigned int estimated = sip.sipCount;
+    double worst = 0.0;
+    const double cycle = 0.1;
+    int sips = (int) rint(duration / cycle);
+    double stall_start = duration / 2.0;
+
+    for (int i = 0; i <= sips; i++)
+    {
+        double sent = i * cycle;
+        double read = sent + 0.002;
+        if (sent >= stall_start && sent < stall_start + stall)
+            read = stall_start + stall + 0.002 + 1e-6 * i;
+        else if (sent >= stall_start + stall)
+            read += 1e-6 * i;
+
+        MakeSIP(buffer, param_idx, speed * sent, speed);
+        sip.ParseStandard(buffer, ros::Time(1000.0 + read));
+
+        if (estimator)
+        {
+            sip.FillStandard(&data);
+            estimator->Update(ros::Time(1000.0 + read),
+                              (sip.sipCount - estimated) * sip.sipCycle, data.position);
+            estimated = sip.sipCount;
+            worst = std::max(worst, fabs(data.position.twist.twist.linear.x - speed / 1e3));
+        }
+    }
+    return worst;
+}
+
+class SIPTest : public ::testing::Test
+{
+  protected:
+    static void SetUpTestCase() { initialize_robot_params(); }
+};
+
+TEST_F(SIPTest, QueuedSIPsAfterStallKeepOdometry)
+{
+    const double speeds[] = { 500.0, 1500.0, -1500.0 };
+    for (int i = 0; i < 3; i++)
+    {
+        SIP sip(P3DX_SH);
+        Replay(sip, P3DX_SH, speeds[i], 4.0, 0.5);
+
+        EXPECT_EQ(0u, sip.odomRejected) << "speed " << speeds[i];
+        EXPECT_NEAR(speeds[i] * 4.0, sip.xpos, 1.0) << "speed " << speeds[i];
+    }
+}
+
+TEST_F(SIPTest, NoStallKeepsOdometry)
+{
+    SIP sip(P3DX_SH);
+    Replay(sip, P3DX_SH, 1500.0, 4.0, 0.0);
+
+    EXPECT_EQ(0u, sip.odomRejected);
+    EXPECT_EQ(0u, sip.odomRecovered);
+    EXPECT_NEAR(6000.0, sip.xpos, 1.0);
+}
+
+// Differentiating the pose of SIPs read back to back after a stall must not
+// turn one cycle of motion into a velocity spike
+TEST_F(SIPTest, QueuedSIPsAfterStallKeepVelocity)
+{
+    const char *modes[] = { "pose", "fused" };
+    const double speeds[] = { 500.0, 1500.0, -1500.0 };
+    for (int m = 0; m < 2; m++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            SIP sip(P3DX_SH);
+            VelocityEstimator estimator;
+            estimator.Init(modes[m], 0.0, 1e-4, 1e-3, 4e-4, 3e-2);
+
+            // the pose is reported to the mm, so 10 mm/s either way
+            double worst = Replay(sip, P3DX_SH, speeds[i], 4.0, 0.5, &estimator);
+            EXPECT_LT(worst, 0.011) << modes[m] << " at speed " << speeds[i];
+        }
+    }
+}
+
+// Once every transducer has reported, parsing and filling a SIP must not
+// touch the heap
+TEST_F(SIPTest, ParseAndFillDoNotAllocate)
+{
+    const int sonars = PlayerRobotParams[P3DX_SH].SonarNum;
+    unsigned char buffer[SIP_BUFFER_LEN];
+    ros_p2os_data_t data;
+    SIP sip(P3DX_SH);
+
+    for (int first = 0; first < sonars; first += 4)
+    {
+        MakeSIP(buffer, P3DX_SH, 0.0, 0.0, first, 4);
+        sip.ParseStandard(buffer, ros::Time(1000.0 + first * 0.1));
+        sip.FillStandard(&data);
+    }
+
+    AllocationCounter counter;
+    for (int i = 0; i < 100; i++)
+    {
+        MakeSIP(buffer, P3DX_SH, 5.0 * i, 50.0, (4 * i) % sonars, 4);
+        sip.ParseStandard(buffer, ros::Time(1002.0 + i * 0.1));
+        sip.FillStandard(&data);
+    }
+    EXPECT_EQ(0ul, counter.Allocations());
+    EXPECT_EQ(sonars, data.sonar.ranges_count);
+}
+
+// A SIP parsed without being published, as when SendReceive() answers a
+// command, must not lose the sonar readings it carried
+TEST_F(SIPTest, SonarsKeptUntilPublished)
+{
+    unsigned char buffer[SIP_BUFFER_LEN];
+    SIP sip(P3DX_SH);
+
+    MakeSIP(buffer, P3DX_SH, 0.0, 0.0, 0, 4);
+    sip.ParseStandard(buffer, ros::Time(1000.0));
+    MakeSIP(buffer, P3DX_SH, 0.0, 0.0);
+    sip.ParseStandard(buffer, ros::Time(1000.1));
+    EXPECT_EQ(0x0Fu, sip.sonarsUpdated);
+
+    // cleared by the node once published
+    sip.sonarsUpdated = 0;
+    MakeSIP(buffer, P3DX_SH, 0.0, 0.0, 4, 2);
+    sip.ParseStandard(buffer, ros::Time(1000.2));
+    EXPECT_EQ(0x30u, sip.sonarsUpdated);
+}
+
+// SIPs coalesced by ReceiveSIP() are all parsed and only the newest is
+// filled in; the readings of every one of them have to be in it
+TEST_F(SIPTest, CoalescedSIPsKeepEverySonar)
+{
+    unsigned char buffer[SIP_BUFFER_LEN];
+    ros_p2os_data_t data;
+    SIP sip(P3DX_SH);
+
+    for (int first = 0; first < 16; first += 4)
+    {
+        MakeSIP(buffer, P3DX_SH, 0.0, 0.0, first, 4);
+        sip.ParseStandard(buffer, ros::Time(1000.0 + first * 0.1));
+    }
+    // the newest SIP reports no sonars at all
+    MakeSIP(buffer, P3DX_SH, 0.0, 0.0);
+    sip.ParseStandard(buffer, ros::Time(1002.0));
+    sip.FillStandard(&data);
+
+    EXPECT_EQ(0xFFFFu, sip.sonarsUpdated);
+    ASSERT_EQ(16, data.sonar.ranges_count);
+    for (int i = 0; i < 16; i++)
+    {
+        EXPECT_GT(data.sonar.ranges[i], 0.0) << "sonar " << i;
+        EXPECT_EQ(ros::Time(1000.0 + (i / 4) * 0.4), data.sonar.stamps[i]) << "sonar " << i;
+    }
+}
+
+int main( int argc, char **argv )
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,102 @@
+/*
+ *  P2OS for ROS
+ *  Copyright (C) 2009
+ *     David Feil-Seifer, Brian Gerkey, Kasper Stoy,
+ *      Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <math.h>
+#include <gtest/gtest.h>
+
+#include <velocity_smoother.h>
+
+// Smooths x towards each of targets[] in turn, every setpoint dt seconds
+// apart and each target following on from arriving at the last, and checks each step against the limits: the acceleration between
+// two setpoints stays within accel, it changes by at most jerk * dt from
+// one step to the next, and no setpoint goes past its target
+static void CheckRamps( double dt, const double *targets, int count )
+{
+    const double accel = 500.0, jerk = 2000.0;   // mm/s^2, mm/s^3
+    const double tol = 1e-6;
+    double a[VelocitySmoother::AXES] = { accel, 0.0, 0.0 };
+    double j[VelocitySmoother::AXES] = { jerk, 0.0, 0.0 };
+    VelocitySmoother smoother;
+    smoother.Init(a, j);
+
+    double vel = 0.0, acc = 0.0;
+    for (int t = 0; t < count; t++)
+    {
+        double from = vel;
+        int steps = 0;
+        do
+        {
+            double v[VelocitySmoother::AXES] = { targets[t], 0.0, 0.0 };
+            smoother.Update(dt, v);
+
+            double next_acc = (v[0] - vel) / dt;
+            EXPECT_LE(fabs(next_acc), accel + tol) << "dt " << dt << " step " << steps;
+            EXPECT_LE(fabs(next_acc - acc), jerk * dt + tol) << "dt " << dt << " step " << steps;
+            EXPECT_LE(std::min(from, targets[t]) - tol, v[0]);
+            EXPECT_GE(std::max(from, targets[t]) + tol, v[0]);
+            vel = v[0];
+            acc = next_acc;
+        } while (vel != targets[t] && ++steps < 1000);
+
+        // the next target is taken up straight away, on the step after
+        // arriving, which is the hardest on the jerk limit
+        EXPECT_EQ(targets[t], vel) << "dt " << dt;
+    }
+
+    // one more step at the last target to stop accelerating
+    double v[VelocitySmoother::AXES] = { targets[count - 1], 0.0, 0.0 };
+    smoother.Update(dt, v);
+    EXPECT_LE(fabs(acc), jerk * dt + tol);
+    EXPECT_TRUE(smoother.Settled());
+}
+
+// Ramps up, reverses, and takes steps too small to reach full acceleration,
+// at the loop periods the driver runs at
+TEST(VelocitySmoother, JerkBoundedEveryStep)
+{
+    const double targets[] = { 500.0, -300.0, -280.0, 0.0, 7.0, 0.0 };
+    const double periods[] = { 0.1, 0.05, 0.02, 0.013 };
+    for (unsigned int i = 0; i < sizeof(periods) / sizeof(periods[0]); i++)
+        CheckRamps(periods[i], targets, sizeof(targets) / sizeof(targets[0]));
+}
+
+// An axis without limits follows its target at once
+TEST(VelocitySmoother, UnlimitedAxisFollows)
+{
+    double a[VelocitySmoother::AXES] = { 500.0, 0.0, 0.0 };
+    double j[VelocitySmoother::AXES] = { 2000.0, 0.0, 0.0 };
+    VelocitySmoother smoother;
+    smoother.Init(a, j);
+
+    double v[VelocitySmoother::AXES] = { 500.0, 200.0, -30.0 };
+    smoother.Update(0.1, v);
+    EXPECT_LT(v[0], 500.0);
+    EXPECT_EQ(200.0, v[1]);
+    EXPECT_EQ(-30.0, v[2]);
+}
+
+int main( int argc, char **argv )
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}